@@ -60,8 +60,302 @@ DOCUMENTATION
                         number of samples
                     out: output array buffer to hold the prediction result
 
+
+        dtree_predict_f16, dtree_predict_bf16
+            void dtree_predict_f16(
+                Tree *tree, const unsigned short *data, int ncol, int nrow,
+                float *out
+            );
+                Same as `dtree_predict`, but for matrices of IEEE half
+                precision (f16) or bfloat16 (bf16) values passed as their raw
+                16-bit patterns. Rows are converted in small blocks (with F16C
+                instructions when compiled with -mf16c), halving the input
+                memory traffic of batch scoring.
+
+
+        dtree_lazy_grow, dtree_lazy_predict_single
+            LazyTree *dtree_lazy_grow(
+                float *data, float *target, int ncol, int nrow,
+                TreeParam param
+            );
+            float dtree_lazy_predict_single(LazyTree *tree, float *data);
+                `dtree_lazy_grow` keeps a copy of the training data but grows
+                nothing. Each query of `dtree_lazy_predict_single` grows only
+                the nodes on its own path, which are kept for later queries,
+                and returns the same prediction as the fully grown tree. Free
+                it with `dtree_lazy_free`.
+
+
+        dtree_stream_new, dtree_stream_update
+            StreamTree *dtree_stream_new(
+                Tree *tree, int ncol, TreeParam param, int window,
+                float delta, float lambda
+            );
+            int dtree_stream_update(
+                StreamTree *stream, float *row, float target
+            );
+                Monitor a grown tree (owned by the stream from then on) on
+                labeled feedback. Every node keeps a Page-Hinkley test on the
+                error of the rows routed through it (`delta` is the tolerated
+                error increase, `lambda` the detection threshold, e.g. 0.005
+                and 50). When a node detects drift, only its subtree is
+                regrown from the rows of the last `window` updates that reach
+                it. `dtree_stream_update` returns 1 when a subtree was
+                regrown. Predict with `stream->tree` and free everything with
+                `dtree_stream_free`.
+
+
+        dtree_grow_feature_parallel
+            Tree *dtree_grow_feature_parallel(
+                float *data, float *target, int ncol, int nrow,
+                TreeParam param, int nworker
+            );
+                Available when LIBDTREE_MULTIPROC_ is defined (POSIX only).
+                Grow the same tree as `dtree_grow_with_param` with `nworker`
+                forked processes, each owning a contiguous slice of the
+                columns. For every node the workers score their own columns,
+                and the coordinator picks the global best split and relays
+                the row partition to the others as a bitmap. With
+                `featcost` or `max_expected_depth` set, or nworker < 1, the
+                tree is grown serially in the calling process instead.
+
+
+        dtree_predict_fetch
+            float dtree_predict_fetch(
+                Tree *tree, int ncol, float (*fetch)(void *ctx, int featidx),
+                void *ctx
+            );
+                Make a single prediction, obtaining feature values through
+                `fetch` only when a node on the path tests them (each feature
+                at most once). Combined with the `featcost` and `costweight`
+                tree parameters, which make the trainer trade information
+                gain against the cost of features not yet acquired on the
+                path, this reduces the features fetched at serving time.
+
+
+        dtree_expected_depth
+            float dtree_expected_depth(Tree *tree);
+                Average number of comparisons a prediction makes, weighted by
+                the training rows reaching each leaf. Setting the
+                `max_expected_depth` tree parameter bounds it during training:
+                the tree is then grown best-first, always expanding the leaf
+                with the highest gain among those that still fit the budget.
+                With `featcost` set, that gain is net of feature costs, as
+                without a budget.
+
+
+        dtree_refit_leaves
+            void dtree_refit_leaves(
+                Tree *tree, float *data, float *target, int ncol, int nrow,
+                float decay
+            );
+                Refresh the leaves of a grown tree with a new labeled batch
+                without touching its splits. The class counts of every leaf
+                are multiplied by `decay` (0 forgets the old data, 1 keeps it
+                fully), the new rows are added to the leaves they reach, and
+                the predicted class of each leaf is recomputed. Leaves that
+                end up with no weight keep their previous prediction.
+
+
+        dtree_decision_path
+            void dtree_decision_path(
+                Tree *tree, float *data, int ncol, int nrow,
+                unsigned long long *path, int *pathlen
+            );
+                Record the decisions taken by each row on its way to a leaf.
+                Bit d of `path[i]` is set when row i went right at depth d,
+                and `pathlen[i]` is the depth of the leaf reached (only the
+                first 64 decisions are stored). Following the bits from the
+                root, the node at depth d has the breadth-first index
+                2^d - 1 + (bits 0..d-1 read with bit 0 as most significant).
+                `dtree_path_node(tree, path, depth)` returns that node.
+
+
+        dtree_pathcache_predict, dtree_pathcache_update
+            PathCache *dtree_pathcache_predict(
+                Tree *tree, float *data, int ncol, int nrow, float *out
+            );
+            float dtree_pathcache_update(
+                PathCache *cache, float *row, int rowidx, int featidx
+            );
+                `dtree_pathcache_predict` works like `dtree_predict` but also
+                caches the path of every row. After changing feature
+                `featidx` of row `rowidx`, `dtree_pathcache_update` returns
+                the new prediction by re-walking only from the first node of
+                the cached path that tests that feature. Call it once per
+                changed feature. Free the cache with `dtree_pathcache_free`.
+
+
+        dtree_forest_grow
+            Forest *dtree_forest_grow(
+                float *data, float *target, int ncol, int nrow, int ntree,
+                TreeParam param
+            );
+                Train a bagged forest of `ntree` decision trees, each grown on
+                a bootstrap sample of the rows drawn with `rand()` (seed it
+                with `srand()` for reproducible forests). The out-of-bag error
+                is computed during training and stored in `forest->oob_error`
+                (NAN when no row was ever out of bag).
+
+                Arguments
+                ---------
+                    data: flatten numeric values following row-major matrix
+                        order
+                    target: target classes, encoded from 0, 1, ..., nclass-1
+                    ncol: number of columns (or features)
+                    nrow: number of samples
+                    ntree: number of trees in the forest
+                    param: the struct containing tree parameters
+
+
+        dtree_forest_extend
+            void dtree_forest_extend(
+                Forest *forest, float *data, float *target, int ncol,
+                int nrow, int ntree, TreeParam param, int samerows
+            );
+                Append `ntree` more bagged trees to a trained forest, keeping
+                the existing ones. Pass `samerows` = 1 when the rows are the
+                ones the forest was trained on: the out-of-bag votes of the
+                earlier trees are then kept and `forest->oob_error` covers
+                the whole forest. With `samerows` = 0 it restarts from the
+                new trees.
+
+
+        dtree_forest_predict_single, dtree_forest_predict
+            Same as `dtree_predict_single` and `dtree_predict`, but take the
+            majority vote of the trees in the forest.
+
+
+        dtree_forest_predict_binned
+            void dtree_forest_predict_binned(
+                Forest *forest, float *data, int ncol, int nrow, float *out
+            );
+                Same as `dtree_forest_predict`, but each row is quantized
+                once against the sorted thresholds of all trees (built on the
+                first call and kept in the forest), after which every node
+                comparison is a 16-bit integer compare. A feature with more
+                than 65535 distinct thresholds would overflow the codes; such
+                forests are predicted with float compares instead.
+
+
+        dtree_hist_alloc, dtree_hist_build, dtree_hist_merge,
+        dtree_hist_subtract, dtree_grow_from_hist
+            Tree *dtree_grow_from_hist(
+                HistCallback callback, void *ctx, float *edges, int ncol,
+                int nbin, int nclass, TreeParam param
+            );
+                Grow a tree without access to the rows, from node-level class
+                count histograms. `edges` holds nbin - 1 sorted bin edges per
+                feature (row-major), and the split thresholds are taken from
+                them. For every node, `callback(ctx, conds, ncond, out)` must
+                fill `out` with the histogram of the rows satisfying the
+                `conds` of the path to the node, e.g. by calling
+                `dtree_hist_build` on each data shard and
+                `dtree_hist_merge` on the results. Only the smaller child of
+                a split is requested, the other one is obtained with
+                `dtree_hist_subtract`. A `Hist` is one contiguous block of
+                `dtree_hist_bytes(hist)` bytes, so it can be sent as is.
+
+
+        dtree_dataset_new, dtree_dataset_hist_build, dtree_dataset_bytes,
+        dtree_dataset_free
+            Dataset *dtree_dataset_new(
+                float *data, float *target, int ncol, int nrow, float *edges,
+                int nbin
+            );
+                Keep a shard in memory as compressed bin codes instead of
+                floats. Every column is cut in blocks of rows; a block stores
+                its smallest code and the others as bit-packed offsets from
+                it, with no payload at all when the block is constant.
+                `dtree_dataset_hist_build(hist, ds, conds, ncond)` is the
+                `dtree_hist_build` of this storage, for conditions whose
+                thresholds are bin edges (as in `dtree_grow_from_hist`).
+                At most 65536 bins and 65536 classes.
+
+
+        dtree_iforest_grow
+            Forest *dtree_iforest_grow(
+                float *data, int ncol, int nrow, int ntree, int nsub
+            );
+                Train an isolation forest for anomaly detection. Each tree is
+                grown on `nsub` rows sampled without replacement (256 is the
+                usual choice) using random features and random thresholds, up
+                to depth ceil(log2(nsub)). The result is a `Forest` with
+                nclass = 0 whose leaves hold the expected remaining path
+                length. Score it with `dtree_iforest_score`; the classifier
+                predictors (`dtree_forest_predict*`) return NAN for it.
+
+
+        dtree_iforest_score
+            void dtree_iforest_score(
+                Forest *forest, float *data, int ncol, int nrow, float *out
+            );
+                Compute the anomaly score 2^(-E[h(x)] / c(nsub)) of each row
+                into `out`. Scores close to 1 indicate anomalies, scores well
+                below 0.5 indicate normal rows.
+
+
+        dtree_shap_single, dtree_shap
+            void dtree_shap_single(Tree *tree, float *data, int ncol,
+                                   float *phi);
+            void dtree_shap(
+                Tree *tree, float *data, int ncol, int nrow, float *out
+            );
+                Compute TreeSHAP feature attributions of the tree output using
+                the node sample counts recorded during growth. For each row,
+                ncol + 1 values are written: the attribution of every feature
+                followed by the base value (the expected output), so that they
+                sum up to the prediction. `dtree_shap` writes nrow * (ncol + 1)
+                values into `out` and runs rows in parallel when compiled with
+                OpenMP (-fopenmp). The tree output is the predicted class index,
+                so the attributions are only meaningful for binary trees.
+
+
+        dtree_partial_dependence
+            void dtree_partial_dependence(
+                Tree *tree, int *feats, int nfeat, float *grid, int ngrid,
+                float *out
+            );
+                Compute the partial dependence of the tree output on the
+                `nfeat` features listed in `feats` (usually one or two). `grid`
+                holds ngrid points of nfeat values each (row-major), and the
+                averaged prediction at each point is written into `out`. It
+                uses the node sample counts instead of the training data, so
+                its cost does not depend on the number of rows.
+                The prediction being a class index, the average is only
+                meaningful for binary trees (the share of class 1).
+
+
+        dtree_flatten
+            FlatModel *dtree_flatten(
+                Tree **trees, int ntree, int nclass, void *buf
+            );
+                Write one tree (ntree = 1) or the trees of a forest into
+                `buf` as a single position-independent block, which must hold
+                `dtree_flat_size(trees, ntree)` bytes. Nodes refer to their
+                children by index, so the block may be copied, saved, or
+                mapped at any address. Predict with `dtree_flat_predict_single`
+                and `dtree_flat_predict`, which return NAN when nclass <= 0
+                (an isolation forest).
+
+
+        dtree_shm_publish, dtree_shm_attach, dtree_shm_detach
+            Available when LIBDTREE_SHM_ is defined before including any
+            header (POSIX only). `dtree_shm_publish` places the flat model in
+            the named shared-memory segment, `dtree_shm_attach` maps it
+            read-only in another process, so all workers share a single
+            physical copy. Publishing again under the same name replaces
+            the segment for new attaches, while attached workers keep the
+            old model until they detach. Remove the segment with
+            `shm_unlink(name)`.
+
 NOTES
 
+    * Define LIBDTREE_HUGEPAGE_ before including any header to allocate the
+      large training buffers (transposed columns, row index arrays and node
+      buffers, forest bootstrap rows, histograms and their sub-histograms,
+      and compressed Dataset blocks) 2 MB aligned and advised for transparent huge pages
+      (Linux), which reduces TLB misses on large datasets.
     * This library only provides support for training decision tree classifier.
       The input data is assumed to be ALL numerical.
     * The data loading, data preprocessing, and other auxillary functionalities
@@ -91,12 +385,95 @@ NOTES
 
 typedef struct Tree Tree;
 typedef struct TreeParam TreeParam;
+typedef struct Forest Forest;
+typedef struct FlatModel FlatModel;
+typedef struct PathCache PathCache;
+typedef struct ThreshTable ThreshTable;
+typedef struct LazyTree LazyTree;
+typedef struct StreamTree StreamTree;
+typedef struct Hist Hist;
+typedef struct NodeCond NodeCond;
+typedef struct Dataset Dataset;
+typedef void (*HistCallback)(void* ctx, NodeCond* conds, int ncond, Hist* out);
 
 Tree* dtree_grow(float* data, float* target, int ncol, int nrow);
 Tree* dtree_grow_with_param(float* data, float* target, int ncol, int nrow,
                             TreeParam param);
+float dtree_expected_depth(Tree* tree);
 float dtree_predict_single(Tree* tree, float* data);
+float dtree_predict_fetch(Tree* tree, int ncol,
+                          float (*fetch)(void* ctx, int featidx), void* ctx);
+LazyTree* dtree_lazy_grow(float* data, float* target, int ncol, int nrow,
+                          TreeParam param);
+float dtree_lazy_predict_single(LazyTree* tree, float* data);
+void dtree_lazy_free(LazyTree* tree);
+StreamTree* dtree_stream_new(Tree* tree, int ncol, TreeParam param,
+                             int window, float delta, float lambda);
+int dtree_stream_update(StreamTree* stream, float* row, float target);
+void dtree_stream_free(StreamTree* stream);
 void dtree_predict(Tree* tree, float* data, int ncol, int nrow, float* out);
+void dtree_predict_f16(Tree* tree, const unsigned short* data, int ncol,
+                       int nrow, float* out);
+void dtree_predict_bf16(Tree* tree, const unsigned short* data, int ncol,
+                        int nrow, float* out);
+#ifdef LIBDTREE_MULTIPROC_
+Tree* dtree_grow_feature_parallel(float* data, float* target, int ncol,
+                                  int nrow, TreeParam param, int nworker);
+#endif
+void dtree_refit_leaves(Tree* tree, float* data, float* target, int ncol,
+                        int nrow, float decay);
+void dtree_decision_path(Tree* tree, float* data, int ncol, int nrow,
+                         unsigned long long* path, int* pathlen);
+Tree* dtree_path_node(Tree* tree, unsigned long long path, int depth);
+PathCache* dtree_pathcache_predict(Tree* tree, float* data, int ncol,
+                                   int nrow, float* out);
+float dtree_pathcache_update(PathCache* cache, float* row, int rowidx,
+                             int featidx);
+void dtree_pathcache_free(PathCache* cache);
+Forest* dtree_forest_grow(float* data, float* target, int ncol, int nrow,
+                          int ntree, TreeParam param);
+void dtree_forest_extend(Forest* forest, float* data, float* target, int ncol,
+                         int nrow, int ntree, TreeParam param, int samerows);
+float dtree_forest_predict_single(Forest* forest, float* data);
+void dtree_forest_predict(Forest* forest, float* data, int ncol, int nrow,
+                          float* out);
+void dtree_forest_free(Forest* forest);
+void dtree_forest_predict_binned(Forest* forest, float* data, int ncol,
+                                 int nrow, float* out);
+Hist* dtree_hist_alloc(int ncol, int nbin, int nclass);
+long dtree_hist_bytes(Hist* hist);
+void dtree_hist_merge(Hist* dst, Hist* src);
+void dtree_hist_subtract(Hist* dst, Hist* src);
+void dtree_hist_build(Hist* hist, float* data, float* target, int nrow,
+                      float* edges, NodeCond* conds, int ncond);
+void dtree_hist_free(Hist* hist);
+Tree* dtree_grow_from_hist(HistCallback callback, void* ctx, float* edges,
+                           int ncol, int nbin, int nclass, TreeParam param);
+Dataset* dtree_dataset_new(float* data, float* target, int ncol, int nrow,
+                           float* edges, int nbin);
+long dtree_dataset_bytes(Dataset* ds);
+void dtree_dataset_hist_build(Hist* hist, Dataset* ds, NodeCond* conds,
+                              int ncond);
+void dtree_dataset_free(Dataset* ds);
+Forest* dtree_iforest_grow(float* data, int ncol, int nrow, int ntree,
+                           int nsub);
+void dtree_iforest_score(Forest* forest, float* data, int ncol, int nrow,
+                         float* out);
+void dtree_shap_single(Tree* tree, float* data, int ncol, float* phi);
+void dtree_shap(Tree* tree, float* data, int ncol, int nrow, float* out);
+void dtree_partial_dependence(Tree* tree, int* feats, int nfeat, float* grid,
+                              int ngrid, float* out);
+long dtree_flat_size(Tree** trees, int ntree);
+FlatModel* dtree_flatten(Tree** trees, int ntree, int nclass, void* buf);
+float dtree_flat_predict_single(FlatModel* model, float* data);
+void dtree_flat_predict(FlatModel* model, float* data, int ncol, int nrow,
+                        float* out);
+#ifdef LIBDTREE_SHM_
+FlatModel* dtree_shm_publish(const char* name, Tree** trees, int ntree,
+                             int nclass);
+FlatModel* dtree_shm_attach(const char* name);
+void dtree_shm_detach(FlatModel* model);
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -104,10 +481,56 @@ void dtree_predict(Tree* tree, float* data, int ncol, int nrow, float* out);
 //
 ////////////////////////////////////////////////////////////////////////////////
 
+#if (defined(LIBDTREE_SHM_) || defined(LIBDTREE_MULTIPROC_)) && \
+    !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if defined(LIBDTREE_HUGEPAGE_) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#ifdef LIBDTREE_HUGEPAGE_
+#include <sys/mman.h>
+#define LDT_HUGEPAGE (2L << 20)
+#endif
+
+// Allocates a large training buffer, to be released with free(). With
+// LIBDTREE_HUGEPAGE_ defined, buffers of 2 MB or more are 2 MB aligned and
+// advised for transparent huge pages to cut TLB misses in the split loops.
+void* ldt_bufalloc(size_t size) {
+#ifdef LIBDTREE_HUGEPAGE_
+    if (size >= LDT_HUGEPAGE) {
+        void* buf = NULL;
+        size = (size + LDT_HUGEPAGE - 1) & ~(LDT_HUGEPAGE - 1);
+        if (posix_memalign(&buf, LDT_HUGEPAGE, size) != 0) return NULL;
+#ifdef MADV_HUGEPAGE
+        madvise(buf, size, MADV_HUGEPAGE);
+#endif
+        return buf;
+    }
+#endif
+    return malloc(size);
+}
+
+// Reads through row indices become random loads once the rows of a node
+// are scattered; they are prefetched LDT_PREFETCH_DIST rows ahead.
+#ifndef LDT_PREFETCH_DIST
+#define LDT_PREFETCH_DIST 16
+#endif
+#ifdef __GNUC__
+#define LDT_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define LDT_PREFETCH(addr) ((void)0)
+#endif
+
 // Some helper data structure for dynamic array
 
 typedef struct {
@@ -158,6 +581,10 @@ struct Tree {
     int featidx;
     float thresh;
     float gain;
+    int nsample;  // number of training rows that reached this node
+    int thrbin;  // position of thresh in the forest threshold table
+    int nclass;  // length of counts
+    float* counts;  // class distribution of the rows in a leaf
     Tree* lnode;
     Tree* rnode;
 };
@@ -165,6 +592,9 @@ struct Tree {
 struct TreeParam {
     int maxdepth;
     int min_sample_split;
+    float* featcost;  // acquisition cost of each feature, NULL for none
+    float costweight;  // gain traded for one unit of feature cost
+    float max_expected_depth;  // budget on the average comparisons, 0 for none
 };
 
 typedef struct Split {
@@ -197,55 +627,80 @@ float* ldt_bincount(float* x, long arrlen) {
     return res;
 }
 
-Tree* classify_asleaf(float* target, int arrlen) {
-    int max = (int)ldt_arrmax(target, arrlen);
-    int cnt[max + 1];
-    for (int i = 0; i < max + 1; i++) cnt[i] = 0;
-
-    for (int i = 0; i < arrlen; i++) {
-        cnt[(int)target[i]]++;
-    }
-
-    int idxmax = 0;
-    int currmax = cnt[idxmax];
-    for (int i = 0; i < max + 1; i++) {
-        if (cnt[i] > currmax) {
-            idxmax = i;
-            currmax = cnt[i];
-        }
+static inline float ldt_countentropy(const unsigned int* cnt, int nclass,
+                                     unsigned int total) {
+    float entropy = 0;
+    for (int c = 0; c < nclass; c++) {
+        if (cnt[c] == 0) continue;
+        float p = cnt[c] / (float)total;
+        entropy += p * log2f(p);
     }
+    return -entropy;
+}
 
+// leaf predicting the majority class of the given class counts
+Tree* ldt_leaf(const unsigned int* cnt, int nclass) {
     Tree* n = (Tree*)malloc(sizeof(*n));
     n->isleaf = 1;
-    n->value = (float)idxmax;
+    n->nclass = nclass;
+    n->counts = (float*)malloc(nclass * sizeof(*n->counts));
+    n->nsample = 0;
+    int best = 0;
+    for (int c = 0; c < nclass; c++) {
+        n->counts[c] = cnt[c];
+        n->nsample += cnt[c];
+        if (cnt[c] > cnt[best]) best = c;
+    }
+    n->value = (float)best;
     n->lnode = NULL;
     n->rnode = NULL;
     return n;
 }
 
-static inline float entropy(float* x, long arrlen) {
-    float* bc = ldt_bincount(x, arrlen);
-    int max = (int)ldt_arrmax(x, arrlen);
-    ldt_arrdiv(bc, (float)arrlen, max + 1);
+// Class counts of the rows of a node, computed in a single pass and shared
+// by the purity test, the split search and leaf creation.
+typedef struct NodeStats {
+    int nrow;
+    int nclass;
+    int npresent;  // classes with at least one row
+    float entropy;
+    unsigned int* cnt;  // nclass counts, owned by the caller
+} NodeStats;
+
+static NodeStats ldt_nodestats_fromcnt(unsigned int* cnt, int nrow,
+                                       int nclass) {
+    NodeStats st = {.nrow = nrow, .nclass = nclass, .cnt = cnt};
+    st.npresent = 0;
+    for (int c = 0; c < nclass; c++) st.npresent += cnt[c] > 0;
+    st.entropy = ldt_countentropy(cnt, nclass, nrow);
+    return st;
+}
 
-    float entropy = 0.0;
-    List u = ldt_listunique(x, arrlen);
-    for (int i = 0; i < u.len; i++) {
-        if (bc[(int)u.data[i]] > 0)
-            entropy += bc[(int)u.data[i]] * log2f(bc[(int)u.data[i]]);
-    }
+NodeStats ldt_nodestats(float* target, int nrow, int nclass,
+                        unsigned int* cnt) {
+    for (int c = 0; c < nclass; c++) cnt[c] = 0;
+    for (int i = 0; i < nrow; i++) cnt[(int)target[i]]++;
+    return ldt_nodestats_fromcnt(cnt, nrow, nclass);
+}
 
-    free(bc);
-    ldt_listfree(&u);
-    return -entropy;
+// same for the rows idx[0..nrow) of target
+NodeStats ldt_nodestats_idx(const float* target, const int* idx, int nrow,
+                            int nclass, unsigned int* cnt) {
+    for (int c = 0; c < nclass; c++) cnt[c] = 0;
+    int i = 0;
+    for (; i + LDT_PREFETCH_DIST < nrow; i++) {
+        LDT_PREFETCH(target + idx[i + LDT_PREFETCH_DIST]);
+        cnt[(int)target[idx[i]]]++;
+    }
+    for (; i < nrow; i++) cnt[(int)target[idx[i]]]++;
+    return ldt_nodestats_fromcnt(cnt, nrow, nclass);
 }
 
-static inline float gain(float* parent, float* left, float* right, int nparent,
-                         int nleft, int nright) {
-    float lprop = nleft / (float)nparent;
-    float rprop = nright / (float)nparent;
-    return (entropy(parent, nparent) -
-            (lprop * entropy(left, nleft) + rprop * entropy(right, nright)));
+Tree* classify_asleaf(float* target, int arrlen) {
+    int nclass = (int)ldt_arrmax(target, arrlen) + 1;
+    unsigned int cnt[nclass];
+    ldt_nodestats(target, arrlen, nclass, cnt);
+    return ldt_leaf(cnt, nclass);
 }
 
 inline void ldt_getcol(float* data, int idxcol, int ncol, int nrow,
@@ -260,110 +715,444 @@ int ispure(float* data, int arrlen) {
     return res;
 }
 
-Split best_split(float* data, float* target, int ncol, int nrow) {
-    Split split;
-    split.ldata = NULL;
-    split.rdata = NULL;
-    split.ltarget = NULL;
-    split.rtarget = NULL;
-    split.featidx = 0;
-    split.thresh = 0;
-    split.lnrow = 0;
-    split.rnrow = 0;
-    split.gain = 0;
-    float bestgain = -1;
+// Best threshold over the features [fbegin, fend), scored from the targets
+// only. featidx is -1 when no threshold leaves rows on both sides.
+typedef struct SplitCand {
+    int featidx;
+    float thresh;
+    float gain;
+    int lnrow;
+} SplitCand;
+
+// Scores every threshold of feature f, given its values xcol on the rows
+// of the node, and keeps the best one in *best. The gain of a threshold
+// only needs the class counts of its left side: the right side and the
+// parent entropy follow from the node statistics. A nonzero penalty is
+// subtracted from the gain of every threshold.
+static void ldt_scan_feature(float* xcol, const float* target, int nrow, int f,
+                             float penalty, const NodeStats* st,
+                             SplitCand* best) {
+    int nclass = st->nclass;
+    unsigned int lcnt[nclass], rcnt[nclass];
+    List unique = ldt_listunique(xcol, nrow);
+
+    // iterate over thresholds (i.e., the unique values) and take the
+    // best one
+    for (int i = 0; i < unique.len; i++) {
+        for (int c = 0; c < nclass; c++) lcnt[c] = 0;
+        int lnrow = 0;
+        for (int row = 0; row < nrow; row++) {
+            if (xcol[row] <= unique.data[i]) {
+                lcnt[(int)target[row]]++;
+                lnrow++;
+            }
+        }
+        int rnrow = nrow - lnrow;
+
+        if ((lnrow > 0) && (rnrow > 0)) {
+            for (int c = 0; c < nclass; c++) rcnt[c] = st->cnt[c] - lcnt[c];
+            float g = st->entropy -
+                      (lnrow * ldt_countentropy(lcnt, nclass, lnrow) +
+                       rnrow * ldt_countentropy(rcnt, nclass, rnrow)) /
+                          nrow;
+            if (penalty) g -= penalty;
+            if (g > best->gain) {
+                best->gain = g;
+                best->featidx = f;
+                best->thresh = unique.data[i];
+                best->lnrow = lnrow;
+            }
+        }
+    }
+    ldt_listfree(&unique);
+}
+
+// With a penalty, candidates on feature f are ranked by their gain minus
+// penalty[f], and that score is what the returned gain holds.
+SplitCand ldt_best_split_range(float* data, float* target, int ncol, int nrow,
+                               int fbegin, int fend, const float* penalty,
+                               const NodeStats* st) {
+    SplitCand best = {.featidx = -1, .thresh = 0, .gain = -1, .lnrow = 0};
 
     // buffer to get each column data (the f-th) in the following iteration
     float xcol[nrow];
-
-    for (int f = 0; f < ncol; f++) {
+    for (int f = fbegin; f < fend; f++) {
         ldt_getcol(data, f, ncol, nrow, xcol);
-        List unique = ldt_listunique(xcol, nrow);
-
-        // iterater over theslholds (i.e., the unique values) and take
-        // the best one
-        for (int i = 0; i < unique.len; i++) {
-            float leftdata[ncol * nrow];
-            float lefttarget[nrow];
-            float rightdata[ncol * nrow];
-            float righttarget[nrow];
-            int lnrow = 0;
-            int rnrow = 0;
-            int loffset = 0;
-            int roffset = 0;
-
-            // split data
-            for (int row = 0; row < nrow; row++) {
-                if (data[f + ncol * row] <= unique.data[i]) {
-                    for (int c = 0; c < ncol; c++)
-                        leftdata[loffset++] = data[c + ncol * row];
-                    lefttarget[lnrow++] = target[row];
-                } else {
-                    for (int c = 0; c < ncol; c++)
-                        rightdata[roffset++] = data[c + ncol * row];
-                    righttarget[rnrow++] = target[row];
-                }
-            }
+        ldt_scan_feature(xcol, target, nrow, f, penalty ? penalty[f] : 0, st,
+                         &best);
+    }
+    return best;
+}
 
-            // obtain a split with best gain
-            if ((lnrow > 0) && (rnrow > 0)) {
-                float g = gain(target, lefttarget, righttarget, nrow, lnrow, rnrow);
-
-                if (g > bestgain) {
-                    // set the current best split
-                    split.gain = g;
-                    split.featidx = f;
-                    split.thresh = unique.data[i];
-                    split.lnrow = lnrow;
-                    split.rnrow = rnrow;
-
-                    // free the buffers before (re)allocating
-                    free(split.ldata), free(split.ltarget);
-                    free(split.rdata), free(split.rtarget);
-
-                    split.ldata = (float*)malloc(loffset * sizeof(*leftdata));
-                    split.ltarget = (float*)malloc(lnrow * sizeof(*lefttarget));
-                    split.rdata = (float*)malloc(roffset * sizeof(*rightdata));
-                    split.rtarget = (float*)malloc(rnrow * sizeof(*lefttarget));
-                    memcpy(split.ldata, leftdata, loffset * sizeof(*leftdata));
-                    memcpy(split.ltarget, lefttarget, lnrow * sizeof(*lefttarget));
-                    memcpy(split.rdata, rightdata, roffset * sizeof(*rightdata));
-                    memcpy(split.rtarget, righttarget, rnrow * sizeof(*righttarget));
-                }
-            }
+// Row partition of a split as a bitmap, bit `row` set when the row goes
+// left. It is all that needs to be shared to partition other columns.
+void ldt_split_bitmap(float* data, int ncol, int nrow, int featidx,
+                      float thresh, unsigned char* bitmap) {
+    memset(bitmap, 0, (nrow + 7) / 8);
+    for (int row = 0; row < nrow; row++)
+        if (data[featidx + ncol * row] <= thresh)
+            bitmap[row >> 3] |= 1 << (row & 7);
+}
+
+// copies the rows of data and target into the left or right buffers of the
+// split according to the bitmap
+void ldt_partition(float* data, float* target, int ncol, int nrow,
+                   unsigned char* bitmap, Split* split) {
+    int lnrow = 0;
+    for (int row = 0; row < nrow; row++)
+        lnrow += (bitmap[row >> 3] >> (row & 7)) & 1;
+    split->lnrow = lnrow;
+    split->rnrow = nrow - lnrow;
+
+    split->ldata = (float*)malloc(ncol * split->lnrow * sizeof(*data));
+    split->ltarget = (float*)malloc(split->lnrow * sizeof(*target));
+    split->rdata = (float*)malloc(ncol * split->rnrow * sizeof(*data));
+    split->rtarget = (float*)malloc(split->rnrow * sizeof(*target));
+
+    int l = 0, r = 0;
+    for (int row = 0; row < nrow; row++) {
+        float* src = data + ncol * row;
+        if ((bitmap[row >> 3] >> (row & 7)) & 1) {
+            memcpy(split->ldata + ncol * l, src, ncol * sizeof(*data));
+            split->ltarget[l++] = target[row];
+        } else {
+            memcpy(split->rdata + ncol * r, src, ncol * sizeof(*data));
+            split->rtarget[r++] = target[row];
         }
-        ldt_listfree(&unique);
     }
+}
 
+Split best_split(float* data, float* target, int ncol, int nrow,
+                 const float* penalty, const NodeStats* st) {
+    Split split = {.ldata = NULL};
+    SplitCand best =
+        ldt_best_split_range(data, target, ncol, nrow, 0, ncol, penalty, st);
+    if (best.featidx < 0) return split;
+
+    split.featidx = best.featidx;
+    split.thresh = best.thresh;
+    split.gain = best.gain;
+    unsigned char* bitmap = (unsigned char*)malloc((nrow + 7) / 8);
+    ldt_split_bitmap(data, ncol, nrow, best.featidx, best.thresh, bitmap);
+    ldt_partition(data, target, ncol, nrow, bitmap, &split);
+    free(bitmap);
     return split;
 }
 
-Tree* ldt_grow(float* data, float* target, int ncol, int nrow, int depth,
-               TreeParam param) {
-    if (ispure(target, nrow) || (nrow < param.min_sample_split) ||
-        (depth == param.maxdepth)) {
-        Tree* res = classify_asleaf(target, nrow);
-        return res;
+//
+// Column-major training set
+
+// The training rows are transposed once per tree (or forest) so that
+// scanning a feature is unit stride. A node is a range of an index array
+// into these rows, and splitting it only reorders that range.
+typedef struct ColData {
+    float* cols;  // cols[f * nrow + row]
+    float* target;
+    int ncol;
+    int nrow;
+    int nclass;
+    int* scratch;           // nrow indices, used while partitioning
+    float* xcol;            // one column of the rows of a node
+    float* ytarget;         // the targets of the rows of a node
+    unsigned char* bitmap;  // (nrow + 7) / 8 bytes, the split of a node
+} ColData;
+
+float* ldt_transpose(float* data, int ncol, int nrow) {
+    float* cols = (float*)ldt_bufalloc((long)ncol * nrow * sizeof(*cols));
+    // blocks of rows stay in cache while each of their columns is written
+    for (int r0 = 0; r0 < nrow; r0 += 64) {
+        int r1 = r0 + 64 < nrow ? r0 + 64 : nrow;
+        for (int f = 0; f < ncol; f++)
+            for (int r = r0; r < r1; r++)
+                cols[(long)f * nrow + r] = data[(long)r * ncol + f];
+    }
+    return cols;
+}
+
+ColData ldt_coldata(float* data, float* target, int ncol, int nrow) {
+    ColData cd;
+    cd.cols = ldt_transpose(data, ncol, nrow);
+    cd.target = target;
+    cd.ncol = ncol;
+    cd.nrow = nrow;
+    cd.nclass = (int)ldt_arrmax(target, nrow) + 1;
+    cd.scratch = (int*)ldt_bufalloc(nrow * sizeof(*cd.scratch));
+    cd.xcol = (float*)ldt_bufalloc(nrow * sizeof(*cd.xcol));
+    cd.ytarget = (float*)ldt_bufalloc(nrow * sizeof(*cd.ytarget));
+    cd.bitmap = (unsigned char*)ldt_bufalloc((nrow + 7) / 8);
+    return cd;
+}
+
+void ldt_coldata_free(ColData* cd) {
+    free(cd->cols), free(cd->scratch);
+    free(cd->xcol), free(cd->ytarget), free(cd->bitmap);
+}
+
+// dst[i] = src[idx[i]] for the rows of a node
+static inline void ldt_gather(const float* src, const int* idx, int nrow,
+                              float* dst) {
+    int i = 0;
+    for (; i + LDT_PREFETCH_DIST < nrow; i++) {
+        LDT_PREFETCH(src + idx[i + LDT_PREFETCH_DIST]);
+        dst[i] = src[idx[i]];
+    }
+    for (; i < nrow; i++) dst[i] = src[idx[i]];
+}
+
+// Nodes whose columns fit in LDT_GATHER_BYTES are copied out of the
+// training set once, so that their whole subtree scans a small, dense
+// buffer instead of gathering from the full columns.
+#ifndef LDT_GATHER_BYTES
+#define LDT_GATHER_BYTES (256L << 10)
+#endif
+
+static ColData ldt_coldata_gather(ColData* cd, const int* idx, int nrow) {
+    ColData local = *cd;
+    local.nrow = nrow;
+    local.cols = (float*)malloc((long)cd->ncol * nrow * sizeof(float));
+    local.target = (float*)malloc(nrow * sizeof(float));
+    local.scratch = (int*)malloc(nrow * sizeof(int));
+    local.xcol = (float*)malloc(nrow * sizeof(float));
+    local.ytarget = (float*)malloc(nrow * sizeof(float));
+    local.bitmap = (unsigned char*)malloc((nrow + 7) / 8);
+    for (int f = 0; f < cd->ncol; f++)
+        ldt_gather(cd->cols + (long)f * cd->nrow, idx, nrow,
+                   local.cols + (long)f * nrow);
+    ldt_gather(cd->target, idx, nrow, local.target);
+    return local;
+}
+
+// ldt_best_split_range over the rows idx[0..nrow) of the features
+// [fbegin, fend)
+SplitCand ldt_best_split_cols(ColData* cd, const int* idx, int nrow,
+                              int fbegin, int fend, const float* penalty,
+                              const NodeStats* st) {
+    SplitCand best = {.featidx = -1, .thresh = 0, .gain = -1, .lnrow = 0};
+
+    ldt_gather(cd->target, idx, nrow, cd->ytarget);
+    for (int f = fbegin; f < fend; f++) {
+        ldt_gather(cd->cols + (long)f * cd->nrow, idx, nrow, cd->xcol);
+        ldt_scan_feature(cd->xcol, cd->ytarget, nrow, f,
+                         penalty ? penalty[f] : 0, st, &best);
+    }
+    return best;
+}
+
+// bitmap of the rows idx[0..nrow) going left, as in ldt_split_bitmap
+void ldt_split_bitmap_idx(const float* col, const int* idx, int nrow,
+                          float thresh, unsigned char* bitmap) {
+    memset(bitmap, 0, (nrow + 7) / 8);
+    for (int i = 0; i < nrow; i++) {
+        if (i + LDT_PREFETCH_DIST < nrow)
+            LDT_PREFETCH(col + idx[i + LDT_PREFETCH_DIST]);
+        if (col[idx[i]] <= thresh) bitmap[i >> 3] |= 1 << (i & 7);
+    }
+}
+
+// Moves the indices flagged in the bitmap to the front of idx, keeping the
+// order on both sides, and returns how many there are.
+int ldt_partition_idx(int* idx, int nrow, const unsigned char* bitmap,
+                      int* scratch) {
+    int l = 0, r = 0;
+    for (int i = 0; i < nrow; i++) {
+        if ((bitmap[i >> 3] >> (i & 7)) & 1)
+            idx[l++] = idx[i];
+        else
+            scratch[r++] = idx[i];
+    }
+    memcpy(idx + l, scratch, r * sizeof(*idx));
+    return l;
+}
+
+static int ldt_split_idx(ColData* cd, int* idx, int nrow, int featidx,
+                         float thresh) {
+    ldt_split_bitmap_idx(cd->cols + (long)featidx * cd->nrow, idx, nrow, thresh,
+                         cd->bitmap);
+    return ldt_partition_idx(idx, nrow, cd->bitmap, cd->scratch);
+}
+
+static inline int ldt_isstop(const NodeStats* st, int depth, TreeParam param) {
+    return (st->npresent <= 1) || (st->nrow < param.min_sample_split) ||
+           (depth == param.maxdepth);
+}
+
+// Grows the node made of the rows idx[0..nrow). `used` flags the features
+// already tested on the path to the node (NULL without feature costs);
+// they are free to test again.
+Tree* ldt_grow_path(ColData* cd, int* idx, int nrow, int depth,
+                    TreeParam param, unsigned char* used) {
+    int ncol = cd->ncol, nclass = cd->nclass;
+    if ((long)nrow * ncol * sizeof(float) <= LDT_GATHER_BYTES &&
+        (long)cd->nrow * ncol * sizeof(float) > LDT_GATHER_BYTES) {
+        ColData local = ldt_coldata_gather(cd, idx, nrow);
+        int* lidx = (int*)malloc(nrow * sizeof(*lidx));
+        for (int i = 0; i < nrow; i++) lidx[i] = i;
+        Tree* tree = ldt_grow_path(&local, lidx, nrow, depth, param, used);
+        free(lidx), free(local.target);
+        ldt_coldata_free(&local);
+        return tree;
+    }
+
+    unsigned int cnt[nclass];
+    NodeStats st = ldt_nodestats_idx(cd->target, idx, nrow, nclass, cnt);
+    if (ldt_isstop(&st, depth, param)) {
+        return ldt_leaf(cnt, nclass);
     } else {
-        Split best = best_split(data, target, ncol, nrow);
-        Tree* left =
-            ldt_grow(best.ldata, best.ltarget, ncol, best.lnrow, depth + 1, param);
-        Tree* right =
-            ldt_grow(best.rdata, best.rtarget, ncol, best.rnrow, depth + 1, param);
+        float penalty[ncol];
+        for (int f = 0; f < ncol; f++)
+            penalty[f] = used && !used[f] ? param.costweight * param.featcost[f]
+                                          : 0;
+
+        SplitCand best = ldt_best_split_cols(cd, idx, nrow, 0, ncol,
+                                             used ? penalty : NULL, &st);
+        // with costs, a split must also pay for the feature it acquires
+        if (best.featidx < 0 || (used && best.gain <= 0))
+            return ldt_leaf(cnt, nclass);
+
+        int lnrow = ldt_split_idx(cd, idx, nrow, best.featidx, best.thresh);
+        unsigned char wasused = used ? used[best.featidx] : 0;
+        if (used) used[best.featidx] = 1;
+        Tree* left = ldt_grow_path(cd, idx, lnrow, depth + 1, param, used);
+        Tree* right = ldt_grow_path(cd, idx + lnrow, nrow - lnrow, depth + 1,
+                                    param, used);
+        if (used) used[best.featidx] = wasused;
 
         Tree* n = (Tree*)malloc(sizeof(*n));
         n->featidx = best.featidx;
         n->thresh = best.thresh;
         n->isleaf = 0;
-        n->gain = best.gain;
+        n->gain = used ? best.gain + penalty[best.featidx] : best.gain;
+        n->nsample = nrow;
+        n->nclass = 0;
+        n->counts = NULL;
         n->lnode = left;
         n->rnode = right;
+        return n;
+    }
+}
 
-        free(best.ldata), free(best.ltarget);
-        free(best.rdata), free(best.rtarget);
+//
+// Best-first growth under an expected path length budget
 
-        return n;
+typedef struct {
+    Tree* leaf;  // turned into an internal node when expanded
+    int depth;
+    int* idx;  // rows of the leaf
+    int nrow;
+    SplitCand split;  // best split of the rows of the leaf
+    unsigned char* used;  // features of the path and of split, or NULL
+} Frontier;
+
+// Creates the leaf of a node and queues it when it can be split further.
+// `used` flags the features tested on the path to the node, as in
+// ldt_grow_path.
+static Tree* ldt_frontier_push(Frontier* frontier, int* len, ColData* cd,
+                               int* idx, int nrow, int depth, TreeParam param,
+                               const unsigned char* used) {
+    int ncol = cd->ncol, nclass = cd->nclass;
+    unsigned int cnt[nclass];
+    NodeStats st = ldt_nodestats_idx(cd->target, idx, nrow, nclass, cnt);
+    Tree* leaf = ldt_leaf(cnt, nclass);
+    if (ldt_isstop(&st, depth, param)) return leaf;
+
+    float penalty[ncol];
+    for (int f = 0; f < ncol; f++)
+        penalty[f] =
+            used && !used[f] ? param.costweight * param.featcost[f] : 0;
+    SplitCand split = ldt_best_split_cols(cd, idx, nrow, 0, ncol,
+                                          used ? penalty : NULL, &st);
+    // with costs, a split must also pay for the feature it acquires
+    if (split.featidx < 0 || (used && split.gain <= 0)) return leaf;
+    frontier[*len].leaf = leaf;
+    frontier[*len].depth = depth;
+    frontier[*len].idx = idx;
+    frontier[*len].nrow = nrow;
+    frontier[*len].split = split;
+    frontier[*len].used = NULL;
+    if (used) {
+        frontier[*len].used = (unsigned char*)malloc(ncol);
+        memcpy(frontier[*len].used, used, ncol);
+        frontier[*len].used[split.featidx] = 1;
+    }
+    (*len)++;
+    return leaf;
+}
+
+// Every expansion of a leaf holding n of the N rows adds n / N to the
+// expected depth and reduces the weighted entropy by n / N * gain, so the
+// leaf with the highest gain among those that still fit the budget is the
+// one reducing error the most per unit of inference cost. Queued leaves
+// own disjoint ranges of idx, so partitioning one leaves the others valid.
+// With feature costs, gains are net of the cost of the feature, as in
+// ldt_grow_path.
+Tree* ldt_grow_bestfirst(ColData* cd, int* idx, int nrow, int depth,
+                         TreeParam param) {
+    Frontier* frontier = (Frontier*)malloc(nrow * sizeof(*frontier));
+    int len = 0;
+    unsigned char* used =
+        param.featcost ? (unsigned char*)calloc(cd->ncol, 1) : NULL;
+    Tree* root =
+        ldt_frontier_push(frontier, &len, cd, idx, nrow, depth, param, used);
+    free(used);
+
+    float budget = param.max_expected_depth * nrow;  // in rows
+    for (;;) {
+        int pick = -1;
+        for (int i = 0; i < len; i++) {
+            if (frontier[i].leaf->nsample > budget) continue;
+            if (pick < 0 || frontier[i].split.gain > frontier[pick].split.gain)
+                pick = i;
+        }
+        if (pick < 0) break;
+
+        Frontier cur = frontier[pick];
+        frontier[pick] = frontier[--len];
+        budget -= cur.leaf->nsample;
+
+        SplitCand* sp = &cur.split;
+        Tree* n = cur.leaf;
+        free(n->counts);
+        n->isleaf = 0;
+        n->featidx = sp->featidx;
+        n->thresh = sp->thresh;
+        n->gain = sp->gain;
+        n->nclass = 0;
+        n->counts = NULL;
+        int lnrow = ldt_split_idx(cd, cur.idx, cur.nrow, sp->featidx, sp->thresh);
+        n->lnode = ldt_frontier_push(frontier, &len, cd, cur.idx, lnrow,
+                                     cur.depth + 1, param, cur.used);
+        n->rnode = ldt_frontier_push(frontier, &len, cd, cur.idx + lnrow,
+                                     cur.nrow - lnrow, cur.depth + 1, param,
+                                     cur.used);
+        free(cur.used);
     }
+
+    for (int i = 0; i < len; i++) free(frontier[i].used);
+    free(frontier);
+    return root;
+}
+
+Tree* ldt_grow_cols(ColData* cd, int* idx, int nrow, int depth,
+                    TreeParam param) {
+    if (param.max_expected_depth > 0)
+        return ldt_grow_bestfirst(cd, idx, nrow, depth, param);
+    if (!param.featcost) return ldt_grow_path(cd, idx, nrow, depth, param, NULL);
+
+    unsigned char* used = (unsigned char*)calloc(cd->ncol, sizeof(*used));
+    Tree* tree = ldt_grow_path(cd, idx, nrow, depth, param, used);
+    free(used);
+    return tree;
+}
+
+Tree* ldt_grow(float* data, float* target, int ncol, int nrow, int depth,
+               TreeParam param) {
+    ColData cd = ldt_coldata(data, target, ncol, nrow);
+    int* idx = (int*)ldt_bufalloc(nrow * sizeof(*idx));
+    for (int i = 0; i < nrow; i++) idx[i] = i;
+    Tree* tree = ldt_grow_cols(&cd, idx, nrow, depth, param);
+    free(idx);
+    ldt_coldata_free(&cd);
+    return tree;
 }
 
 void dtree_free(Tree* tree) {
@@ -371,9 +1160,28 @@ void dtree_free(Tree* tree) {
         dtree_free(tree->lnode);
         dtree_free(tree->rnode);
     }
+    free(tree->counts);
     free(tree);
 }
 
+static long ldt_weighted_depth(Tree* tree, int depth) {
+    if (tree->isleaf) return (long)tree->nsample * depth;
+    return ldt_weighted_depth(tree->lnode, depth + 1) +
+           ldt_weighted_depth(tree->rnode, depth + 1);
+}
+
+// average number of comparisons per prediction over the training rows
+float dtree_expected_depth(Tree* tree) {
+    return ldt_weighted_depth(tree, 0) / (float)tree->nsample;
+}
+
+int ldt_depth(Tree* tree) {
+    if (tree->isleaf) return 0;
+    int l = ldt_depth(tree->lnode);
+    int r = ldt_depth(tree->rnode);
+    return 1 + (l > r ? l : r);
+}
+
 Tree* dtree_grow_with_param(float* data, float* target, int ncol, int nrow,
                             TreeParam param) {
     return ldt_grow(data, target, ncol, nrow, 0, param);
@@ -398,6 +1206,24 @@ float dtree_predict_single(Tree* tree, float* data) {
     return dtree_predict_single(tree->rnode, data);
 }
 
+// Fetches features through the callback only when a node on the path tests
+// them, each at most once per prediction.
+float dtree_predict_fetch(Tree* tree, int ncol,
+                          float (*fetch)(void* ctx, int featidx), void* ctx) {
+    float value[ncol];
+    unsigned char fetched[ncol];
+    memset(fetched, 0, ncol);
+    while (!tree->isleaf) {
+        int f = tree->featidx;
+        if (!fetched[f]) {
+            value[f] = fetch(ctx, f);
+            fetched[f] = 1;
+        }
+        tree = value[f] <= tree->thresh ? tree->lnode : tree->rnode;
+    }
+    return tree->value;
+}
+
 void dtree_predict(Tree* tree, float* data, int ncol, int nrow, float* out) {
     long cnt = 0;
     for (int i = 0; i < nrow * ncol; i += ncol) {
@@ -410,88 +1236,2694 @@ void dtree_predict(Tree* tree, float* data, int ncol, int nrow, float* out) {
     }
 }
 
-////////////////////////////////////////////////////////////////////////////////
-//
-// Unit testing
 //
-////////////////////////////////////////////////////////////////////////////////
+// Half-precision input implementations
+
+// rows converted to float32 at once by the half-precision predictors
+#define LDT_HALF_BLOCK 64
+
+static inline float ldt_f16tofloat(unsigned short h) {
+    unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+    unsigned int exp = (h >> 10) & 0x1f;
+    unsigned int mant = h & 0x3ff;
+    unsigned int bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000u | (mant << 13);  // inf and nan
+    } else if (exp != 0) {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    } else if (mant == 0) {
+        bits = sign;
+    } else {
+        // subnormal half, normal float
+        exp = 113;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            exp--;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
 
-#ifdef LIBDTREE_TEST_
+static inline float ldt_bf16tofloat(unsigned short h) {
+    unsigned int bits = (unsigned int)h << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
 
-#include <stdio.h>
+static void ldt_f16tofloat_n(const unsigned short* src, float* dst, long n) {
+    long i = 0;
+#ifdef __F16C__
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i,
+                         _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)(src + i))));
+#endif
+    for (; i < n; i++) dst[i] = ldt_f16tofloat(src[i]);
+}
 
-void assert_eq_int(int x, int y, char* title) {
-    if (x == y)
-        printf("\033[32m[PASS] %s\033[0m\n", title);
-    else
-        printf("\033[31m[FAIL] %s: left=%d right=%d\033[31m\n", title, x, y);
+static void ldt_bf16tofloat_n(const unsigned short* src, float* dst, long n) {
+    for (long i = 0; i < n; i++) dst[i] = ldt_bf16tofloat(src[i]);
 }
 
-void assert_eq_float(float x, float y, char* title) {
-    if (x == y)
-        printf("\033[32m[PASS] %s\033[0m\n", title);
-    else
-        printf("\033[31m[FAIL] %s: left=%f right=%f\033[31m\n", title, x, y);
+// converts blocks of rows into a small float32 buffer that stays in cache,
+// so the full matrix is never materialized in float32
+static void ldt_predict_half(Tree* tree, const unsigned short* data, int ncol,
+                             int nrow, float* out, int isbf16) {
+    float* buf = (float*)malloc((long)LDT_HALF_BLOCK * ncol * sizeof(*buf));
+    for (int i = 0; i < nrow; i += LDT_HALF_BLOCK) {
+        int n = nrow - i < LDT_HALF_BLOCK ? nrow - i : LDT_HALF_BLOCK;
+        const unsigned short* src = data + (long)i * ncol;
+        if (isbf16)
+            ldt_bf16tofloat_n(src, buf, (long)n * ncol);
+        else
+            ldt_f16tofloat_n(src, buf, (long)n * ncol);
+        for (int k = 0; k < n; k++)
+            out[i + k] = dtree_predict_single(tree, buf + (long)k * ncol);
+    }
+    free(buf);
 }
 
-void test_list() {
-    List l = ldt_listalloc();
-    ldt_listpush(&l, 1), ldt_listpush(&l, 2), ldt_listpush(&l, 3);
-    assert_eq_int(l.len, 3, "list_len_equals_to_3");
-    assert_eq_float(l.data[1], 2, "2nd_list_elem_equals_to_2");
-    ldt_listfree(&l);
+void dtree_predict_f16(Tree* tree, const unsigned short* data, int ncol,
+                       int nrow, float* out) {
+    ldt_predict_half(tree, data, ncol, nrow, out, 0);
 }
 
-void test_arrunique() {
-    float arr[7] = {1, 2, 3, 3, 4, 5, 4};
-    float* bc = ldt_bincount(arr, 7);
-    assert_eq_float(bc[0], 0, "test_bincount_0");
-    assert_eq_float(bc[1], 1, "test_bincount_1");
-    assert_eq_float(bc[2], 1, "test_bincount_2");
-    assert_eq_float(bc[3], 2, "test_bincount_3");
-    assert_eq_float(bc[4], 2, "test_bincount_4");
-    assert_eq_float(bc[5], 1, "test_bincount_5");
-    free(bc);
+void dtree_predict_bf16(Tree* tree, const unsigned short* data, int ncol,
+                        int nrow, float* out) {
+    ldt_predict_half(tree, data, ncol, nrow, out, 1);
 }
 
-void test_ispure() {
-    float arr_impure[7] = {1, 2, 3, 3, 4, 5, 4};
-    float arr_pure[7] = {1, 1, 1, 1, 1, 1, 1};
-    assert_eq_int(ispure(arr_impure, 7), 0, "test_impure");
-    assert_eq_int(ispure(arr_pure, 7), 1, "test_pure");
+static void ldt_decay_leaves(Tree* node, float decay) {
+    if (!node->isleaf) {
+        ldt_decay_leaves(node->lnode, decay);
+        ldt_decay_leaves(node->rnode, decay);
+        return;
+    }
+    for (int c = 0; c < node->nclass; c++) node->counts[c] *= decay;
 }
 
-void test_classify() {
-    float case1[5] = {1, 1, 2, 2, 2};
-    Tree* res1 = classify_asleaf(case1, 5);
-    assert_eq_int(res1->isleaf, 1, "test_classification_res_is_a_leaf");
-    assert_eq_int(res1->value, 2, "test_classification_case1_is_correct");
+// recomputes leaf values from their counts and the sample counts bottom-up
+static int ldt_refit_finish(Tree* node) {
+    if (!node->isleaf) {
+        node->nsample =
+            ldt_refit_finish(node->lnode) + ldt_refit_finish(node->rnode);
+        return node->nsample;
+    }
 
-    float case2[5] = {1, 1, 1, 1, 1};
-    Tree* res2 = classify_asleaf(case2, 5);
-    assert_eq_int(res2->value, 1, "test_classification_case2_is_correct");
+    float total = 0;
+    int best = 0;
+    for (int c = 0; c < node->nclass; c++) {
+        total += node->counts[c];
+        if (node->counts[c] > node->counts[best]) best = c;
+    }
+    // a leaf that kept no weight keeps its previous value
+    if (total > 0) node->value = (float)best;
+    node->nsample = (int)ceilf(total);
+    return node->nsample;
+}
 
-    float case3[1] = {8};
-    Tree* res3 = classify_asleaf(case3, 1);
-    assert_eq_int(res3->value, 8, "test_classification_case3_is_correct");
+void dtree_refit_leaves(Tree* tree, float* data, float* target, int ncol,
+                        int nrow, float decay) {
+    ldt_decay_leaves(tree, decay);
+    for (int i = 0; i < nrow; i++) {
+        float* row = data + (long)i * ncol;
+        Tree* n = tree;
+        while (!n->isleaf)
+            n = row[n->featidx] <= n->thresh ? n->lnode : n->rnode;
+
+        int c = (int)target[i];
+        if (c >= n->nclass) {
+            n->counts = (float*)realloc(n->counts, (c + 1) * sizeof(*n->counts));
+            for (int k = n->nclass; k <= c; k++) n->counts[k] = 0;
+            n->nclass = c + 1;
+        }
+        n->counts[c] += 1;
+    }
+    ldt_refit_finish(tree);
 }
 
-void test_arrdiv() {
-    float arr[2] = {4, 4};
-    ldt_arrdiv(arr, 2, 2);
-    assert_eq_int(arr[0], 2, "test_4/4=2");
-    assert_eq_int(arr[1], 2, "test_4/4=2");
-    ldt_arrdiv(arr, 2, 2);
-    assert_eq_int(arr[0], 1, "test_2/2=1");
-    assert_eq_int(arr[1], 1, "test_2/2=1");
+void dtree_decision_path(Tree* tree, float* data, int ncol, int nrow,
+                         unsigned long long* path, int* pathlen) {
+    for (int i = 0; i < nrow; i++) {
+        float* row = data + (long)i * ncol;
+        unsigned long long mask = 0;
+        int depth = 0;
+        Tree* n = tree;
+        while (!n->isleaf) {
+            if (row[n->featidx] <= n->thresh) {
+                n = n->lnode;
+            } else {
+                if (depth < 64) mask |= 1ULL << depth;
+                n = n->rnode;
+            }
+            depth++;
+        }
+        path[i] = mask;
+        pathlen[i] = depth;
+    }
 }
 
-void run_tests() {
-    test_list();
-    test_arrunique();
-    test_ispure();
-    test_classify();
-    test_arrdiv();
+Tree* dtree_path_node(Tree* tree, unsigned long long path, int depth) {
+    for (int d = 0; d < depth && d < 64 && !tree->isleaf; d++)
+        tree = (path >> d) & 1 ? tree->rnode : tree->lnode;
+    return tree;
+}
+
+#ifdef LIBDTREE_MULTIPROC_
+
+//
+// Feature-parallel (multi-process) growth implementations
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Every worker process owns a slice of the columns and mirrors the
+// recursion of the coordinator. At each node the workers send their local
+// best split (scored by ldt_best_split_range), the coordinator picks the
+// global best and relays the winner's row bitmap to the other workers.
+
+static void ldt_fp_write(int fd, const void* buf, long size) {
+    const char* p = (const char*)buf;
+    while (size > 0) {
+        long n = write(fd, p, size);
+        if (n <= 0) return;
+        p += n;
+        size -= n;
+    }
+}
+
+static void ldt_fp_read(int fd, void* buf, long size) {
+    char* p = (char*)buf;
+    while (size > 0) {
+        long n = read(fd, p, size);
+        if (n <= 0) return;
+        p += n;
+        size -= n;
+    }
+}
+
+// Workers see only their own columns: cd->cols starts at column foffset.
+static void ldt_fp_worker(ColData* cd, int* idx, int nrow, int depth,
+                          TreeParam param, int foffset, int self, int in,
+                          int out) {
+    unsigned int cnt[cd->nclass];
+    NodeStats st = ldt_nodestats_idx(cd->target, idx, nrow, cd->nclass, cnt);
+    if (ldt_isstop(&st, depth, param)) return;
+
+    SplitCand cand =
+        ldt_best_split_cols(cd, idx, nrow, 0, cd->ncol, NULL, &st);
+    if (cand.featidx >= 0) cand.featidx += foffset;
+    ldt_fp_write(out, &cand, sizeof(cand));
+
+    int winner = -1;
+    ldt_fp_read(in, &winner, sizeof(winner));
+    if (winner < 0) return;
+
+    int nbyte = (nrow + 7) / 8;
+    unsigned char* bitmap = cd->bitmap;
+    if (winner == self) {
+        float* col = cd->cols + (long)(cand.featidx - foffset) * cd->nrow;
+        ldt_split_bitmap_idx(col, idx, nrow, cand.thresh, bitmap);
+        ldt_fp_write(out, bitmap, nbyte);
+    } else {
+        ldt_fp_read(in, bitmap, nbyte);
+    }
+
+    int lnrow = ldt_partition_idx(idx, nrow, bitmap, cd->scratch);
+    ldt_fp_worker(cd, idx, lnrow, depth + 1, param, foffset, self, in, out);
+    ldt_fp_worker(cd, idx + lnrow, nrow - lnrow, depth + 1, param, foffset,
+                  self, in, out);
+}
+
+// The coordinator only reads the targets of cd and partitions with its
+// buffers.
+static Tree* ldt_fp_grow(ColData* cd, int* idx, int nrow, int depth,
+                         TreeParam param, int nworker, int* to, int* from) {
+    int nclass = cd->nclass;
+    unsigned int cnt[nclass];
+    NodeStats st = ldt_nodestats_idx(cd->target, idx, nrow, nclass, cnt);
+    if (ldt_isstop(&st, depth, param)) return ldt_leaf(cnt, nclass);
+
+    // workers own increasing column ranges, so keeping the first best
+    // candidate matches the serial tie-breaking of best_split
+    SplitCand best = {.featidx = -1, .gain = -1};
+    int winner = -1;
+    for (int w = 0; w < nworker; w++) {
+        SplitCand cand = {.featidx = -1};
+        ldt_fp_read(from[w], &cand, sizeof(cand));
+        if (cand.featidx >= 0 && cand.gain > best.gain) {
+            best = cand;
+            winner = w;
+        }
+    }
+    for (int w = 0; w < nworker; w++)
+        ldt_fp_write(to[w], &winner, sizeof(winner));
+    if (winner < 0) return ldt_leaf(cnt, nclass);
+
+    int nbyte = (nrow + 7) / 8;
+    unsigned char* bitmap = cd->bitmap;
+    ldt_fp_read(from[winner], bitmap, nbyte);
+    for (int w = 0; w < nworker; w++)
+        if (w != winner) ldt_fp_write(to[w], bitmap, nbyte);
+    int lnrow = ldt_partition_idx(idx, nrow, bitmap, cd->scratch);
+
+    Tree* n = (Tree*)malloc(sizeof(*n));
+    n->featidx = best.featidx;
+    n->thresh = best.thresh;
+    n->isleaf = 0;
+    n->gain = best.gain;
+    n->nsample = nrow;
+    n->nclass = 0;
+    n->counts = NULL;
+    n->lnode =
+        ldt_fp_grow(cd, idx, lnrow, depth + 1, param, nworker, to, from);
+    n->rnode = ldt_fp_grow(cd, idx + lnrow, nrow - lnrow, depth + 1, param,
+                           nworker, to, from);
+    return n;
+}
+
+Tree* dtree_grow_feature_parallel(float* data, float* target, int ncol,
+                                  int nrow, TreeParam param, int nworker) {
+    // feature costs need the features used on the path and a budget needs
+    // the whole frontier, which the workers do not share: grow serially, as
+    // without any worker
+    if (param.featcost || param.max_expected_depth > 0 || nworker < 1)
+        return ldt_grow(data, target, ncol, nrow, 0, param);
+
+    if (nworker > ncol) nworker = ncol;
+    int to[nworker], from[nworker];
+    pid_t pids[nworker];
+
+    // transposed once, before the workers inherit it
+    ColData cd = ldt_coldata(data, target, ncol, nrow);
+    int* idx = (int*)ldt_bufalloc(nrow * sizeof(*idx));
+    for (int i = 0; i < nrow; i++) idx[i] = i;
+
+    int started = 0;
+    for (int w = 0; w < nworker; w++) {
+        int down[2], up[2];
+        if (pipe(down) != 0) break;
+        if (pipe(up) != 0) {
+            close(down[0]), close(down[1]);
+            break;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(down[0]), close(down[1]), close(up[0]), close(up[1]);
+            break;
+        }
+        if (pid == 0) {
+            close(down[1]), close(up[0]);
+            for (int k = 0; k < w; k++) close(to[k]), close(from[k]);
+
+            // keep only the owned columns, which are contiguous
+            int fbegin = w * ncol / nworker;
+            ColData wcd = cd;
+            wcd.cols += (long)fbegin * nrow;
+            wcd.ncol = (w + 1) * ncol / nworker - fbegin;
+            ldt_fp_worker(&wcd, idx, nrow, 0, param, fbegin, w, down[0],
+                          up[1]);
+            _exit(0);
+        }
+        close(down[0]), close(up[1]);
+        to[w] = down[1];
+        from[w] = up[0];
+        pids[w] = pid;
+        started++;
+    }
+
+    Tree* tree;
+    if (started == nworker) {
+        tree = ldt_fp_grow(&cd, idx, nrow, 0, param, nworker, to, from);
+    } else {
+        // could not start every worker: let the others exit, grow serially
+        tree = ldt_grow_cols(&cd, idx, nrow, 0, param);
+    }
+
+    for (int w = 0; w < started; w++) {
+        close(to[w]), close(from[w]);
+        waitpid(pids[w], NULL, 0);
+    }
+    free(idx);
+    ldt_coldata_free(&cd);
+    return tree;
+}
+
+#endif
+
+//
+// Lazy (query-driven) tree implementations
+
+typedef struct LazyNode LazyNode;
+
+// A node keeps its training rows until a query reaches it. It is then
+// expanded, exactly as ldt_grow would, and the rows move to its children.
+struct LazyNode {
+    int expanded;
+    int isleaf;
+    float value;
+    int featidx;
+    float thresh;
+    int depth;
+    float* data;
+    float* target;
+    int nrow;
+    LazyNode* lnode;
+    LazyNode* rnode;
+};
+
+struct LazyTree {
+    int ncol;
+    int nclass;
+    int nexpanded;  // number of nodes grown so far
+    TreeParam param;
+    LazyNode* root;
+};
+
+static LazyNode* ldt_lazynode(float* data, float* target, int nrow,
+                              int depth) {
+    LazyNode* n = (LazyNode*)calloc(1, sizeof(*n));
+    n->data = data;
+    n->target = target;
+    n->nrow = nrow;
+    n->depth = depth;
+    return n;
+}
+
+static void ldt_lazy_expand(LazyTree* tree, LazyNode* n) {
+    unsigned int cnt[tree->nclass];
+    NodeStats st = ldt_nodestats(n->target, n->nrow, tree->nclass, cnt);
+    Split best = {.ldata = NULL};
+    if (!ldt_isstop(&st, n->depth, tree->param))
+        best = best_split(n->data, n->target, tree->ncol, n->nrow, NULL, &st);
+
+    if (best.lnrow == 0 || best.rnrow == 0) {
+        Tree* leaf = ldt_leaf(cnt, tree->nclass);
+        n->isleaf = 1;
+        n->value = leaf->value;
+        dtree_free(leaf);
+        free(best.ldata), free(best.ltarget);
+        free(best.rdata), free(best.rtarget);
+    } else {
+        n->featidx = best.featidx;
+        n->thresh = best.thresh;
+        n->lnode =
+            ldt_lazynode(best.ldata, best.ltarget, best.lnrow, n->depth + 1);
+        n->rnode =
+            ldt_lazynode(best.rdata, best.rtarget, best.rnrow, n->depth + 1);
+    }
+
+    free(n->data), free(n->target);
+    n->data = NULL;
+    n->target = NULL;
+    n->expanded = 1;
+    tree->nexpanded++;
+}
+
+LazyTree* dtree_lazy_grow(float* data, float* target, int ncol, int nrow,
+                          TreeParam param) {
+    float* rdata = (float*)malloc(ncol * nrow * sizeof(*rdata));
+    float* rtarget = (float*)malloc(nrow * sizeof(*rtarget));
+    memcpy(rdata, data, ncol * nrow * sizeof(*data));
+    memcpy(rtarget, target, nrow * sizeof(*target));
+
+    LazyTree* tree = (LazyTree*)malloc(sizeof(*tree));
+    tree->ncol = ncol;
+    tree->nclass = (int)ldt_arrmax(target, nrow) + 1;
+    tree->nexpanded = 0;
+    tree->param = param;
+    tree->root = ldt_lazynode(rdata, rtarget, nrow, 0);
+    return tree;
+}
+
+float dtree_lazy_predict_single(LazyTree* tree, float* data) {
+    LazyNode* n = tree->root;
+    for (;;) {
+        if (!n->expanded) ldt_lazy_expand(tree, n);
+        if (n->isleaf) return n->value;
+        n = data[n->featidx] <= n->thresh ? n->lnode : n->rnode;
+    }
+}
+
+static void ldt_lazynode_free(LazyNode* n) {
+    if (n->lnode) ldt_lazynode_free(n->lnode);
+    if (n->rnode) ldt_lazynode_free(n->rnode);
+    free(n->data), free(n->target);
+    free(n);
+}
+
+void dtree_lazy_free(LazyTree* tree) {
+    ldt_lazynode_free(tree->root);
+    free(tree);
+}
+
+//
+// Drift detection implementations (Page-Hinkley test per node)
+
+typedef struct DriftNode DriftNode;
+
+// Mirrors a node of the monitored tree and tracks the Page-Hinkley
+// statistic of the 0/1 error of the rows routed through it.
+struct DriftNode {
+    Tree* node;
+    int depth;
+    int n;
+    float mean;
+    float cum;
+    float mincum;
+    DriftNode* lnode;
+    DriftNode* rnode;
+};
+
+struct StreamTree {
+    Tree* tree;
+    int ncol;
+    TreeParam param;
+    float delta;  // magnitude of error increase tolerated
+    float lambda;  // detection threshold
+    int nregrow;  // number of subtrees regrown so far
+    int wcap;  // window of the most recent labeled rows (ring buffer)
+    int wlen;
+    int wpos;
+    float* wdata;
+    float* wtarget;
+    DriftNode* monitor;
+};
+
+static DriftNode* ldt_driftnode(Tree* node, int depth) {
+    DriftNode* d = (DriftNode*)calloc(1, sizeof(*d));
+    d->node = node;
+    d->depth = depth;
+    if (!node->isleaf) {
+        d->lnode = ldt_driftnode(node->lnode, depth + 1);
+        d->rnode = ldt_driftnode(node->rnode, depth + 1);
+    }
+    return d;
+}
+
+static void ldt_driftnode_free(DriftNode* d) {
+    if (d->lnode) ldt_driftnode_free(d->lnode);
+    if (d->rnode) ldt_driftnode_free(d->rnode);
+    free(d);
+}
+
+// returns 1 when the error of the node increased significantly
+static inline int ldt_pagehinkley(DriftNode* d, float err, float delta,
+                                  float lambda) {
+    d->n++;
+    d->mean += (err - d->mean) / d->n;
+    d->cum += err - d->mean - delta;
+    if (d->cum < d->mincum) d->mincum = d->cum;
+    return d->cum - d->mincum > lambda;
+}
+
+// Regrows the subtree of a drifted node from the window rows that reach
+// it. The node is overwritten in place so its parent stays untouched.
+static void ldt_stream_regrow(StreamTree* st, DriftNode* d) {
+    int ncol = st->ncol;
+    float* data = (float*)malloc(ncol * st->wlen * sizeof(*data));
+    float* target = (float*)malloc(st->wlen * sizeof(*target));
+    int nrow = 0;
+    for (int i = 0; i < st->wlen; i++) {
+        float* row = st->wdata + i * ncol;
+        Tree* n = st->tree;
+        while (n != d->node && !n->isleaf)
+            n = row[n->featidx] <= n->thresh ? n->lnode : n->rnode;
+        if (n != d->node) continue;
+        memcpy(data + nrow * ncol, row, ncol * sizeof(*row));
+        target[nrow++] = st->wtarget[i];
+    }
+
+    if (nrow > 0) {
+        Tree* sub = ldt_grow(data, target, ncol, nrow, d->depth, st->param);
+        if (!d->node->isleaf) {
+            dtree_free(d->node->lnode);
+            dtree_free(d->node->rnode);
+        }
+        free(d->node->counts);
+        *d->node = *sub;
+        free(sub);
+        st->nregrow++;
+    }
+    free(data), free(target);
+
+    // monitors of the subtree start over
+    if (d->lnode) ldt_driftnode_free(d->lnode);
+    if (d->rnode) ldt_driftnode_free(d->rnode);
+    DriftNode* fresh = ldt_driftnode(d->node, d->depth);
+    *d = *fresh;
+    free(fresh);
+}
+
+StreamTree* dtree_stream_new(Tree* tree, int ncol, TreeParam param,
+                             int window, float delta, float lambda) {
+    StreamTree* st = (StreamTree*)malloc(sizeof(*st));
+    st->tree = tree;
+    st->ncol = ncol;
+    st->param = param;
+    st->delta = delta;
+    st->lambda = lambda;
+    st->nregrow = 0;
+    st->wcap = window;
+    st->wlen = 0;
+    st->wpos = 0;
+    st->wdata = (float*)malloc(ncol * window * sizeof(*st->wdata));
+    st->wtarget = (float*)malloc(window * sizeof(*st->wtarget));
+    st->monitor = ldt_driftnode(tree, 0);
+    return st;
+}
+
+int dtree_stream_update(StreamTree* st, float* row, float target) {
+    memcpy(st->wdata + st->wpos * st->ncol, row, st->ncol * sizeof(*row));
+    st->wtarget[st->wpos] = target;
+    st->wpos = (st->wpos + 1) % st->wcap;
+    if (st->wlen < st->wcap) st->wlen++;
+
+    // the error of a row is the same for every node on its path
+    DriftNode* d = st->monitor;
+    Tree* n = st->tree;
+    while (!n->isleaf)
+        n = row[n->featidx] <= n->thresh ? n->lnode : n->rnode;
+    float err = n->value != target;
+
+    // update every monitor on the path and regrow below the highest one
+    // that detected a drift
+    DriftNode* drifted = NULL;
+    while (d) {
+        if (ldt_pagehinkley(d, err, st->delta, st->lambda) && !drifted)
+            drifted = d;
+        if (d->node->isleaf) break;
+        d = row[d->node->featidx] <= d->node->thresh ? d->lnode : d->rnode;
+    }
+    if (!drifted) return 0;
+    ldt_stream_regrow(st, drifted);
+    return 1;
+}
+
+void dtree_stream_free(StreamTree* st) {
+    ldt_driftnode_free(st->monitor);
+    dtree_free(st->tree);
+    free(st->wdata), free(st->wtarget);
+    free(st);
+}
+
+//
+// Incremental re-prediction implementations
+
+struct PathCache {
+    int nrow;
+    int maxlen;  // depth of the tree + 1
+    int* len;  // number of nodes on the path of each row, leaf included
+    Tree** nodes;  // nrow * maxlen visited nodes, root first
+};
+
+// walks from the k-th node of the cached path of a row, rewriting the rest
+// of the path, and returns the predicted value
+static float ldt_pathcache_walk(PathCache* cache, float* row, int rowidx,
+                                int k) {
+    Tree** nodes = cache->nodes + (long)rowidx * cache->maxlen;
+    Tree* n = nodes[k];
+    while (!n->isleaf) {
+        n = row[n->featidx] <= n->thresh ? n->lnode : n->rnode;
+        nodes[++k] = n;
+    }
+    cache->len[rowidx] = k + 1;
+    return n->value;
+}
+
+PathCache* dtree_pathcache_predict(Tree* tree, float* data, int ncol,
+                                   int nrow, float* out) {
+    PathCache* cache = (PathCache*)malloc(sizeof(*cache));
+    cache->nrow = nrow;
+    cache->maxlen = ldt_depth(tree) + 1;
+    cache->len = (int*)malloc(nrow * sizeof(*cache->len));
+    cache->nodes =
+        (Tree**)malloc((long)nrow * cache->maxlen * sizeof(*cache->nodes));
+
+    for (int i = 0; i < nrow; i++) {
+        cache->nodes[(long)i * cache->maxlen] = tree;
+        out[i] = ldt_pathcache_walk(cache, data + (long)i * ncol, i, 0);
+    }
+    return cache;
+}
+
+// Re-predicts row `rowidx` after feature `featidx` of `row` changed. Only
+// the part of the path below the first node testing that feature is walked
+// again; when the path never tests it, the cached leaf is returned as is.
+float dtree_pathcache_update(PathCache* cache, float* row, int rowidx,
+                             int featidx) {
+    Tree** nodes = cache->nodes + (long)rowidx * cache->maxlen;
+    int len = cache->len[rowidx];
+    for (int k = 0; k < len - 1; k++)
+        if (nodes[k]->featidx == featidx)
+            return ldt_pathcache_walk(cache, row, rowidx, k);
+    return nodes[len - 1]->value;
+}
+
+void dtree_pathcache_free(PathCache* cache) {
+    free(cache->len);
+    free(cache->nodes);
+    free(cache);
+}
+
+//
+// Bagged forest implementations
+
+struct Forest {
+    int ntree;
+    int nclass;
+    int nsub;
+    Tree** trees;
+    float oob_error;
+    int oobnrow;  // number of training rows the OOB votes refer to
+    float* oobvotes;  // oobnrow * nclass out-of-bag votes, kept for extending
+    ThreshTable* bins;  // built on the first binned prediction
+};
+
+void ldt_threshtable_free(ThreshTable* table);
+
+Forest* dtree_forest_grow(float* data, float* target, int ncol, int nrow,
+                          int ntree, TreeParam param) {
+    Forest* forest = (Forest*)malloc(sizeof(*forest));
+    forest->ntree = 0;
+    forest->nclass = 0;
+    forest->nsub = 0;
+    forest->trees = NULL;
+    forest->oob_error = NAN;
+    forest->oobnrow = 0;
+    forest->oobvotes = NULL;
+    forest->bins = NULL;
+    dtree_forest_extend(forest, data, target, ncol, nrow, ntree, param, 0);
+    return forest;
+}
+
+void dtree_forest_extend(Forest* forest, float* data, float* target, int ncol,
+                         int nrow, int ntree, TreeParam param, int samerows) {
+    int first = forest->ntree;
+    forest->ntree += ntree;
+    forest->trees = (Tree**)realloc(forest->trees,
+                                    forest->ntree * sizeof(*forest->trees));
+
+    // the thresholds of the new trees are not in the binned table yet
+    if (forest->bins) ldt_threshtable_free(forest->bins);
+    forest->bins = NULL;
+
+    // OOB votes carry over when the caller says the forest is extended on
+    // the same training rows; otherwise the estimate restarts with the new
+    // trees
+    int nclass = (int)ldt_arrmax(target, nrow) + 1;
+    if (nclass < forest->nclass) nclass = forest->nclass;
+    if (!samerows || !forest->oobvotes || forest->oobnrow != nrow ||
+        forest->nclass != nclass) {
+        free(forest->oobvotes);
+        forest->oobvotes = (float*)calloc(nrow * nclass, sizeof(float));
+        forest->oobnrow = nrow;
+    }
+    forest->nclass = nclass;
+    float* oobvotes = forest->oobvotes;
+
+    // every tree grows from the same transposed rows; a bootstrap sample is
+    // just an index array, with repeats
+    ColData cd = ldt_coldata(data, target, ncol, nrow);
+    int* bidx = (int*)ldt_bufalloc(nrow * sizeof(*bidx));
+    float* bdata = (float*)ldt_bufalloc(ncol * nrow * sizeof(*bdata));
+    float* btarget = (float*)malloc(nrow * sizeof(*btarget));
+    int* inbag = (int*)malloc(nrow * sizeof(*inbag));
+    int* oobidx = (int*)malloc(nrow * sizeof(*oobidx));
+
+    for (int t = first; t < forest->ntree; t++) {
+        // draw a bootstrap sample of the rows (with replacement)
+        memset(inbag, 0, nrow * sizeof(*inbag));
+        float bmax = 0;
+        for (int i = 0; i < nrow; i++) {
+            int r = rand() % nrow;
+            inbag[r] = 1;
+            bidx[i] = r;
+            if (target[r] > bmax) bmax = target[r];
+        }
+        cd.nclass = (int)bmax + 1;
+        forest->trees[t] = ldt_grow_cols(&cd, bidx, nrow, 0, param);
+
+        // score the out-of-bag rows while they are at hand; the bootstrap
+        // buffers are reused as the batch input and output
+        int noob = 0;
+        for (int i = 0; i < nrow; i++) {
+            if (inbag[i]) continue;
+            memcpy(bdata + noob * ncol, data + i * ncol, ncol * sizeof(*data));
+            oobidx[noob++] = i;
+        }
+        dtree_predict(forest->trees[t], bdata, ncol, noob, btarget);
+        for (int i = 0; i < noob; i++)
+            oobvotes[oobidx[i] * nclass + (int)btarget[i]] += 1;
+    }
+
+    // the majority of out-of-bag votes is the OOB prediction of a row; rows
+    // that were in-bag for every tree are left out of the estimate
+    int nscored = 0;
+    int nwrong = 0;
+    for (int i = 0; i < nrow; i++) {
+        float* votes = oobvotes + i * nclass;
+        int best = 0;
+        for (int c = 1; c < nclass; c++)
+            if (votes[c] > votes[best]) best = c;
+        if (votes[best] == 0) continue;
+        nscored++;
+        nwrong += best != (int)target[i];
+    }
+    forest->oob_error = nscored > 0 ? nwrong / (float)nscored : NAN;
+
+    ldt_coldata_free(&cd);
+    free(bidx), free(bdata), free(btarget);
+    free(inbag), free(oobidx);
+}
+
+// Isolation forests (nclass == 0) have no classes to vote for: their
+// leaves hold path lengths, so they predict NAN here.
+float dtree_forest_predict_single(Forest* forest, float* data) {
+    if (forest->nclass <= 0) return NAN;
+    float votes[forest->nclass];
+    for (int c = 0; c < forest->nclass; c++) votes[c] = 0;
+    for (int t = 0; t < forest->ntree; t++)
+        votes[(int)dtree_predict_single(forest->trees[t], data)] += 1;
+
+    int best = 0;
+    for (int c = 1; c < forest->nclass; c++)
+        if (votes[c] > votes[best]) best = c;
+    return (float)best;
+}
+
+void dtree_forest_predict(Forest* forest, float* data, int ncol, int nrow,
+                          float* out) {
+    for (int i = 0; i < nrow; i++)
+        out[i] = dtree_forest_predict_single(forest, data + i * ncol);
+}
+
+void dtree_forest_free(Forest* forest) {
+    for (int t = 0; t < forest->ntree; t++) dtree_free(forest->trees[t]);
+    if (forest->bins) ldt_threshtable_free(forest->bins);
+    free(forest->oobvotes);
+    free(forest->trees);
+    free(forest);
+}
+
+//
+// Pre-binned prediction implementations
+
+// Sorted unique thresholds of every feature over all trees of a forest. A
+// value x is coded as the number of thresholds of its feature below x, so
+// that x <= thresh is equivalent to code(x) <= thrbin for every node.
+#define LDT_BIN_MAXTHRESH 65535
+
+struct ThreshTable {
+    int ncol;
+    int* offset;  // thresholds of feature f are thresh[offset[f]..offset[f+1]]
+    float* thresh;
+    int wide;  // some feature has more thresholds than 16-bit codes can hold
+};
+
+static int ldt_floatcmp(const void* a, const void* b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+static void ldt_collect_thresh(Tree* node, int* count, float* dst) {
+    if (node->isleaf) return;
+    if (dst) dst[count[node->featidx]] = node->thresh;
+    count[node->featidx]++;
+    ldt_collect_thresh(node->lnode, count, dst);
+    ldt_collect_thresh(node->rnode, count, dst);
+}
+
+// number of entries of the sorted array below x
+static inline int ldt_lowerbound(float* arr, int len, float x) {
+    int lo = 0, hi = len;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (arr[mid] < x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void ldt_assign_thrbin(Tree* node, ThreshTable* table) {
+    if (node->isleaf) return;
+    int f = node->featidx;
+    int len = table->offset[f + 1] - table->offset[f];
+    node->thrbin =
+        ldt_lowerbound(table->thresh + table->offset[f], len, node->thresh);
+    ldt_assign_thrbin(node->lnode, table);
+    ldt_assign_thrbin(node->rnode, table);
+}
+
+ThreshTable* ldt_threshtable(Tree** trees, int ntree, int ncol) {
+    ThreshTable* table = (ThreshTable*)malloc(sizeof(*table));
+    table->ncol = ncol;
+    table->offset = (int*)calloc(ncol + 1, sizeof(*table->offset));
+
+    // count, then gather thresholds feature by feature
+    int count[ncol];
+    for (int f = 0; f < ncol; f++) count[f] = 0;
+    for (int t = 0; t < ntree; t++) ldt_collect_thresh(trees[t], count, NULL);
+    for (int f = 0; f < ncol; f++)
+        table->offset[f + 1] = table->offset[f] + count[f];
+
+    float* all = (float*)malloc((table->offset[ncol] + 1) * sizeof(*all));
+    for (int f = 0; f < ncol; f++) count[f] = table->offset[f];
+    for (int t = 0; t < ntree; t++) ldt_collect_thresh(trees[t], count, all);
+
+    // sort and deduplicate each feature in place, compacting as we go
+    int len = 0;
+    for (int f = 0; f < ncol; f++) {
+        float* col = all + table->offset[f];
+        int n = table->offset[f + 1] - table->offset[f];
+        qsort(col, n, sizeof(*col), ldt_floatcmp);
+        table->offset[f] = len;
+        for (int i = 0; i < n; i++)
+            if (i == 0 || col[i] != col[i - 1]) all[len++] = col[i];
+    }
+    table->offset[ncol] = len;
+    table->thresh = all;
+    table->wide = 0;
+    for (int f = 0; f < ncol; f++)
+        if (table->offset[f + 1] - table->offset[f] > LDT_BIN_MAXTHRESH)
+            table->wide = 1;
+
+    for (int t = 0; t < ntree; t++) ldt_assign_thrbin(trees[t], table);
+    return table;
+}
+
+void ldt_threshtable_free(ThreshTable* table) {
+    free(table->offset);
+    free(table->thresh);
+    free(table);
+}
+
+// codes hold up to LDT_BIN_MAXTHRESH distinct thresholds per feature
+static inline void ldt_quantize(ThreshTable* table, float* row,
+                                unsigned short* codes) {
+    for (int f = 0; f < table->ncol; f++) {
+        int off = table->offset[f];
+        codes[f] = (unsigned short)ldt_lowerbound(
+            table->thresh + off, table->offset[f + 1] - off, row[f]);
+    }
+}
+
+void dtree_forest_predict_binned(Forest* forest, float* data, int ncol,
+                                 int nrow, float* out) {
+    if (forest->nclass <= 0) {
+        for (int i = 0; i < nrow; i++) out[i] = NAN;
+        return;
+    }
+    if (!forest->bins)
+        forest->bins = ldt_threshtable(forest->trees, forest->ntree, ncol);
+    // the codes of such a feature would wrap around: compare floats instead
+    if (forest->bins->wide) {
+        dtree_forest_predict(forest, data, ncol, nrow, out);
+        return;
+    }
+
+    unsigned short codes[ncol];
+    float votes[forest->nclass];
+    for (int i = 0; i < nrow; i++) {
+        // quantize the row once, then every node of every tree compares
+        // small integers
+        ldt_quantize(forest->bins, data + (long)i * ncol, codes);
+        for (int c = 0; c < forest->nclass; c++) votes[c] = 0;
+        for (int t = 0; t < forest->ntree; t++) {
+            Tree* n = forest->trees[t];
+            while (!n->isleaf)
+                n = codes[n->featidx] <= n->thrbin ? n->lnode : n->rnode;
+            votes[(int)n->value] += 1;
+        }
+
+        int best = 0;
+        for (int c = 1; c < forest->nclass; c++)
+            if (votes[c] > votes[best]) best = c;
+        out[i] = (float)best;
+    }
+}
+
+//
+// Mergeable histogram implementations
+
+// Class counts of the rows of a node per feature bin. A value x of feature
+// f falls in bin b = number of edges of f below x, with nbin - 1 sorted
+// edges per feature, so that x <= edges[b] exactly when its bin is <= b.
+// The counts follow the header in the same block, so a Hist can be sent or
+// stored as its dtree_hist_bytes() raw bytes. Histograms of disjoint row
+// sets add up, and a child is its parent minus its sibling.
+struct Hist {
+    int ncol;
+    int nbin;
+    int nclass;
+    unsigned int counts[];  // ncol * nbin * nclass, feature-major
+};
+
+// a row belongs to a node when (x[featidx] <= thresh) == isleft holds for
+// every condition on the path from the root
+struct NodeCond {
+    int featidx;
+    float thresh;
+    int isleft;
+};
+
+Hist* dtree_hist_alloc(int ncol, int nbin, int nclass) {
+    long len = (long)ncol * nbin * nclass;
+    long size = sizeof(Hist) + len * sizeof(unsigned int);
+    Hist* hist = (Hist*)ldt_bufalloc(size);
+    memset(hist, 0, size);
+    hist->ncol = ncol;
+    hist->nbin = nbin;
+    hist->nclass = nclass;
+    return hist;
+}
+
+long dtree_hist_bytes(Hist* hist) {
+    return sizeof(*hist) +
+           (long)hist->ncol * hist->nbin * hist->nclass * sizeof(unsigned int);
+}
+
+void dtree_hist_merge(Hist* dst, Hist* src) {
+    long len = (long)dst->ncol * dst->nbin * dst->nclass;
+    for (long i = 0; i < len; i++) dst->counts[i] += src->counts[i];
+}
+
+void dtree_hist_subtract(Hist* dst, Hist* src) {
+    long len = (long)dst->ncol * dst->nbin * dst->nclass;
+    for (long i = 0; i < len; i++) dst->counts[i] -= src->counts[i];
+}
+
+void dtree_hist_free(Hist* hist) { free(hist); }
+
+#define LDT_HIST_NSUB 4  // interleaved sub-histograms
+
+// Consecutive rows often fall in the same bin, and incrementing a counter
+// right after the previous increment of it waits for that store. The
+// build kernels deal rows round-robin to LDT_HIST_NSUB copies of the
+// counts instead, sized by the rows of the node seen so far. A small node
+// counts straight into the histogram, since zeroing and spilling the
+// copies would cost more than its increments. Larger nodes start with
+// 8-bit copies and promote them to 16 bits once a copy could overflow;
+// 16-bit copies are spilled into the histogram whenever that happens.
+typedef struct {
+    void* buf;
+    int width;     // bytes per counter: 0 (no copies yet), 1 or 2
+    long pending;  // bound on the rows in each copy
+    long seen;     // rows counted so far
+} LdtSubHist;
+
+static void ldt_hist_spill(Hist* hist, LdtSubHist* sub) {
+    long len = (long)hist->ncol * hist->nbin * hist->nclass;
+    for (int k = 0; k < LDT_HIST_NSUB; k++) {
+        if (sub->width == 1) {
+            unsigned char* s = (unsigned char*)sub->buf + k * len;
+            for (long i = 0; i < len; i++) hist->counts[i] += s[i];
+        } else {
+            unsigned short* s = (unsigned short*)sub->buf + k * len;
+            for (long i = 0; i < len; i++) hist->counts[i] += s[i];
+        }
+    }
+}
+
+// makes room for nrow more rows, of which at most perlane go to each copy
+static void ldt_hist_reserve(Hist* hist, LdtSubHist* sub, long nrow,
+                             long perlane) {
+    long len = (long)hist->ncol * hist->nbin * hist->nclass;
+    long max = sub->width == 1 ? 255 : 65535;
+    sub->seen += nrow;
+    if (sub->width == 0 &&
+        sub->seen <= (long)LDT_HIST_NSUB * hist->nbin * hist->nclass)
+        return;
+    if (sub->width != 0 && sub->pending + perlane <= max) {
+        sub->pending += perlane;
+        return;
+    }
+    int width = sub->width != 0 || perlane > 255 ? 2 : 1;
+    if (sub->width != 0) ldt_hist_spill(hist, sub);
+    if (width != sub->width) {
+        free(sub->buf);
+        sub->buf = ldt_bufalloc(LDT_HIST_NSUB * len * width);
+        sub->width = width;
+    }
+    memset(sub->buf, 0, LDT_HIST_NSUB * len * width);
+    sub->pending = perlane;
+}
+
+static void ldt_hist_flush(Hist* hist, LdtSubHist* sub) {
+    if (sub->width != 0) ldt_hist_spill(hist, sub);
+    free(sub->buf);
+}
+
+// adds the rows of data (hist->ncol columns) that belong to the node
+void dtree_hist_build(Hist* hist, float* data, float* target, int nrow,
+                      float* edges, NodeCond* conds, int ncond) {
+    int ncol = hist->ncol, nbin = hist->nbin, nclass = hist->nclass;
+    long len = (long)ncol * nbin * nclass;
+    LdtSubHist sub = {NULL, 0, 0, 0};
+    long rank = 0;  // selected rows so far
+    for (int i = 0; i < nrow; i++) {
+        float* row = data + (long)i * ncol;
+        int in = 1;
+        for (int k = 0; k < ncond && in; k++)
+            in = (row[conds[k].featidx] <= conds[k].thresh) == conds[k].isleft;
+        if (!in) continue;
+
+        // each group of LDT_HIST_NSUB rows adds one row to every copy
+        if (rank % LDT_HIST_NSUB == 0)
+            ldt_hist_reserve(hist, &sub, LDT_HIST_NSUB, 1);
+        long lane = (rank++ % LDT_HIST_NSUB) * len;
+        int c = (int)target[i];
+        for (int f = 0; f < ncol; f++) {
+            int b = ldt_lowerbound(edges + f * (nbin - 1), nbin - 1, row[f]);
+            long idx = ((long)f * nbin + b) * nclass + c;
+            if (sub.width == 0)
+                hist->counts[idx]++;
+            else if (sub.width == 1)
+                ((unsigned char*)sub.buf)[lane + idx]++;
+            else
+                ((unsigned short*)sub.buf)[lane + idx]++;
+        }
+    }
+    ldt_hist_flush(hist, &sub);
+}
+
+// Grows the node described by conds from its (owned) histogram. Only the
+// smaller child is requested from the callback; the larger one is derived
+// by subtracting it from the parent histogram.
+static Tree* ldt_grow_hist(HistCallback callback, void* ctx, float* edges,
+                           Hist* hist, NodeCond* conds, int ncond,
+                           TreeParam param) {
+    int nbin = hist->nbin, nclass = hist->nclass;
+
+    // class totals from the bins of any feature
+    unsigned int total[nclass];
+    unsigned int n = 0;
+    int nnonzero = 0;
+    for (int c = 0; c < nclass; c++) {
+        total[c] = 0;
+        for (int b = 0; b < nbin; b++) total[c] += hist->counts[b * nclass + c];
+        n += total[c];
+        nnonzero += total[c] > 0;
+    }
+
+    if (nnonzero <= 1 || (int)n < param.min_sample_split ||
+        ncond == param.maxdepth) {
+        dtree_hist_free(hist);
+        return ldt_leaf(total, nclass);
+    }
+
+    float parent = ldt_countentropy(total, nclass, n);
+    float bestgain = -1;
+    int bestf = -1, bestb = 0;
+    unsigned int left[nclass], right[nclass];
+    for (int f = 0; f < hist->ncol; f++) {
+        unsigned int* fc = hist->counts + (long)f * nbin * nclass;
+        for (int c = 0; c < nclass; c++) left[c] = 0;
+        unsigned int nl = 0;
+        for (int b = 0; b < nbin - 1; b++) {
+            for (int c = 0; c < nclass; c++) {
+                left[c] += fc[b * nclass + c];
+                nl += fc[b * nclass + c];
+            }
+            if (nl == 0 || nl == n) continue;
+            unsigned int nr = n - nl;
+            for (int c = 0; c < nclass; c++) right[c] = total[c] - left[c];
+            float g = parent - (nl * ldt_countentropy(left, nclass, nl) +
+                                nr * ldt_countentropy(right, nclass, nr)) / n;
+            if (g > bestgain) {
+                bestgain = g;
+                bestf = f;
+                bestb = b;
+            }
+        }
+    }
+    if (bestf < 0) {
+        dtree_hist_free(hist);
+        return ldt_leaf(total, nclass);
+    }
+
+    // size of the left child, to ask for the smaller side
+    unsigned int nl = 0;
+    for (int b = 0; b <= bestb; b++)
+        for (int c = 0; c < nclass; c++)
+            nl += hist->counts[((long)bestf * nbin + b) * nclass + c];
+
+    float thresh = edges[bestf * (nbin - 1) + bestb];
+    NodeCond child[ncond + 1];
+    if (ncond) memcpy(child, conds, ncond * sizeof(*conds));
+    child[ncond].featidx = bestf;
+    child[ncond].thresh = thresh;
+    child[ncond].isleft = nl <= n - nl;
+
+    Hist* small = dtree_hist_alloc(hist->ncol, nbin, nclass);
+    callback(ctx, child, ncond + 1, small);
+    dtree_hist_subtract(hist, small);
+    Hist* lhist = child[ncond].isleft ? small : hist;
+    Hist* rhist = child[ncond].isleft ? hist : small;
+
+    Tree* node = (Tree*)malloc(sizeof(*node));
+    node->isleaf = 0;
+    node->featidx = bestf;
+    node->thresh = thresh;
+    node->gain = bestgain;
+    node->nsample = n;
+    node->nclass = 0;
+    node->counts = NULL;
+    child[ncond].isleft = 1;
+    node->lnode =
+        ldt_grow_hist(callback, ctx, edges, lhist, child, ncond + 1, param);
+    child[ncond].isleft = 0;
+    node->rnode =
+        ldt_grow_hist(callback, ctx, edges, rhist, child, ncond + 1, param);
+    return node;
+}
+
+Tree* dtree_grow_from_hist(HistCallback callback, void* ctx, float* edges,
+                           int ncol, int nbin, int nclass, TreeParam param) {
+    Hist* root = dtree_hist_alloc(ncol, nbin, nclass);
+    callback(ctx, NULL, 0, root);
+    return ldt_grow_hist(callback, ctx, edges, root, NULL, 0, param);
+}
+
+//
+// Compressed binned dataset implementations
+
+#define LDT_DS_BLOCK 1024  // rows per block
+
+// Every block of LDT_DS_BLOCK rows of a column (the target being column
+// ncol) holds bin codes as base + an offset of `width` bits, packed in
+// 64-bit words. A constant block has width 0 and no words: run-length for
+// sorted or constant data, frame of reference for small ranges of codes.
+typedef struct {
+    unsigned short base;
+    unsigned char width;
+    long word;  // first word of the block in Dataset.words
+} LdtPacked;
+
+struct Dataset {
+    int ncol;
+    int nrow;
+    int nbin;
+    int nblock;
+    float* edges;
+    LdtPacked* blocks;  // nblock * (ncol + 1), block-major
+    unsigned long long* words;
+    long nword;
+};
+
+static void ldt_ds_pack(const unsigned short* codes, int n, LdtPacked* blk,
+                        unsigned long long* words) {
+    unsigned short lo = codes[0], hi = codes[0];
+    for (int i = 1; i < n; i++) {
+        if (codes[i] < lo) lo = codes[i];
+        if (codes[i] > hi) hi = codes[i];
+    }
+    int width = 0;
+    while ((hi - lo) >> width) width++;
+    blk->base = lo;
+    blk->width = width;
+    if (width == 0) return;
+
+    long nword = ((long)n * width + 63) / 64 + 1;
+    memset(words, 0, nword * sizeof(*words));
+    for (int i = 0; i < n; i++) {
+        unsigned long long v = codes[i] - lo;
+        long bit = (long)i * width;
+        words[bit >> 6] |= v << (bit & 63);
+        if ((bit & 63) + width > 64) words[(bit >> 6) + 1] |= v >> (64 - (bit & 63));
+    }
+}
+
+// Unpacks the n codes of a block that is not constant. Blocks are padded
+// with one word so that both words of a code can always be read, which
+// leaves the loop without branches.
+static void ldt_ds_unpack(const LdtPacked* blk, const unsigned long long* words,
+                          int n, unsigned short* codes) {
+    const unsigned long long* w = words + blk->word;
+    int width = blk->width;
+    unsigned long long mask = (1ULL << width) - 1;
+    for (int i = 0; i < n; i++) {
+        long bit = (long)i * width;
+        int off = bit & 63;
+        unsigned long long v = w[bit >> 6] >> off;
+        v |= (w[(bit >> 6) + 1] << 1) << (63 - off);
+        codes[i] = blk->base + (unsigned short)(v & mask);
+    }
+}
+
+Dataset* dtree_dataset_new(float* data, float* target, int ncol, int nrow,
+                           float* edges, int nbin) {
+    Dataset* ds = (Dataset*)malloc(sizeof(*ds));
+    ds->ncol = ncol;
+    ds->nrow = nrow;
+    ds->nbin = nbin;
+    ds->nblock = (nrow + LDT_DS_BLOCK - 1) / LDT_DS_BLOCK;
+    ds->edges = (float*)malloc((long)ncol * (nbin - 1) * sizeof(*edges));
+    memcpy(ds->edges, edges, (long)ncol * (nbin - 1) * sizeof(*edges));
+    ds->blocks = (LdtPacked*)malloc((long)ds->nblock * (ncol + 1) *
+                                    sizeof(*ds->blocks));
+
+    // worst case 16 bits a code; shrunk once the real size is known
+    long cap = (long)ds->nblock * (ncol + 1) * (LDT_DS_BLOCK / 4 + 1);
+    ds->words = (unsigned long long*)malloc(cap * sizeof(*ds->words));
+    ds->nword = 0;
+
+    unsigned short codes[LDT_DS_BLOCK];
+    for (int blk = 0; blk < ds->nblock; blk++) {
+        int r0 = blk * LDT_DS_BLOCK;
+        int n = nrow - r0 < LDT_DS_BLOCK ? nrow - r0 : LDT_DS_BLOCK;
+        for (int f = 0; f <= ncol; f++) {
+            for (int i = 0; i < n; i++) {
+                long r = r0 + i;
+                codes[i] = f < ncol ? ldt_lowerbound(edges + f * (nbin - 1),
+                                                     nbin - 1,
+                                                     data[r * ncol + f])
+                                    : (unsigned short)target[r];
+            }
+            LdtPacked* p = ds->blocks + (long)blk * (ncol + 1) + f;
+            p->word = ds->nword;
+            ldt_ds_pack(codes, n, p, ds->words + ds->nword);
+            if (p->width > 0) ds->nword += ((long)n * p->width + 63) / 64 + 1;
+        }
+    }
+
+    // move the words to a buffer of their final size
+    unsigned long long* words = (unsigned long long*)ldt_bufalloc(
+        (ds->nword > 0 ? ds->nword : 1) * sizeof(*words));
+    memcpy(words, ds->words, ds->nword * sizeof(*words));
+    free(ds->words);
+    ds->words = words;
+    return ds;
+}
+
+long dtree_dataset_bytes(Dataset* ds) {
+    return sizeof(*ds) + (long)ds->ncol * (ds->nbin - 1) * sizeof(float) +
+           (long)ds->nblock * (ds->ncol + 1) * sizeof(LdtPacked) +
+           ds->nword * sizeof(*ds->words);
+}
+
+// Adds the selected rows of a block to the copies at s, len counters
+// apart, dealing row i to copy i % 4 and the tail to the first.
+static void ldt_ds_accum8(unsigned char* s, long len,
+                          const unsigned short* codes,
+                          const unsigned short* cls, const unsigned char* in,
+                          int n, int nclass) {
+    unsigned char *s0 = s, *s1 = s + len, *s2 = s + 2 * len, *s3 = s + 3 * len;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0[codes[i] * nclass + cls[i]] += in[i];
+        s1[codes[i + 1] * nclass + cls[i + 1]] += in[i + 1];
+        s2[codes[i + 2] * nclass + cls[i + 2]] += in[i + 2];
+        s3[codes[i + 3] * nclass + cls[i + 3]] += in[i + 3];
+    }
+    for (; i < n; i++) s0[codes[i] * nclass + cls[i]] += in[i];
+}
+
+static void ldt_ds_accum16(unsigned short* s, long len,
+                           const unsigned short* codes,
+                           const unsigned short* cls, const unsigned char* in,
+                           int n, int nclass) {
+    unsigned short *s0 = s, *s1 = s + len, *s2 = s + 2 * len, *s3 = s + 3 * len;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0[codes[i] * nclass + cls[i]] += in[i];
+        s1[codes[i + 1] * nclass + cls[i + 1]] += in[i + 1];
+        s2[codes[i + 2] * nclass + cls[i + 2]] += in[i + 2];
+        s3[codes[i + 3] * nclass + cls[i + 3]] += in[i + 3];
+    }
+    for (; i < n; i++) s0[codes[i] * nclass + cls[i]] += in[i];
+}
+
+// The thresholds of conds must be bin edges: x <= edges[b] exactly when the
+// code of x is <= b. Constant feature blocks add the class counts of the
+// selected rows of the block to their single bin without being decoded.
+void dtree_dataset_hist_build(Hist* hist, Dataset* ds, NodeCond* conds,
+                              int ncond) {
+    int ncol = ds->ncol, nbin = hist->nbin, nclass = hist->nclass;
+    int limit[ncond > 0 ? ncond : 1];
+    for (int k = 0; k < ncond; k++)
+        limit[k] = ldt_lowerbound(ds->edges + conds[k].featidx * (nbin - 1),
+                                  nbin - 1, conds[k].thresh);
+
+    unsigned short codes[LDT_DS_BLOCK], cls[LDT_DS_BLOCK];
+    unsigned char in[LDT_DS_BLOCK];
+    unsigned int blkcnt[nclass];
+    long len = (long)ncol * nbin * nclass;
+    LdtSubHist sub = {NULL, 0, 0, 0};
+    for (int blk = 0; blk < ds->nblock; blk++) {
+        int n = ds->nrow - blk * LDT_DS_BLOCK < LDT_DS_BLOCK
+                    ? ds->nrow - blk * LDT_DS_BLOCK
+                    : LDT_DS_BLOCK;
+        LdtPacked* cols = ds->blocks + (long)blk * (ncol + 1);
+
+        memset(in, 1, n);
+        for (int k = 0; k < ncond; k++) {
+            LdtPacked* p = cols + conds[k].featidx;
+            int isleft = conds[k].isleft;
+            if (p->width == 0) {
+                if ((p->base <= limit[k]) != isleft) memset(in, 0, n);
+                continue;
+            }
+            ldt_ds_unpack(p, ds->words, n, codes);
+            for (int i = 0; i < n; i++)
+                in[i] &= (codes[i] <= limit[k]) == isleft;
+        }
+
+        LdtPacked* tp = cols + ncol;
+        if (tp->width == 0) {
+            for (int i = 0; i < n; i++) cls[i] = tp->base;
+        } else {
+            ldt_ds_unpack(tp, ds->words, n, cls);
+        }
+        // rows of the block dealt to each copy, the tail going to the first
+        int nlane[LDT_HIST_NSUB] = {0};
+        for (int c = 0; c < nclass; c++) blkcnt[c] = 0;
+        for (int i = 0; i < n; i++) {
+            blkcnt[cls[i]] += in[i];
+            nlane[i < (n & ~3) ? i & 3 : 0] += in[i];
+        }
+        int nin = 0, perlane = 0;
+        for (int k = 0; k < LDT_HIST_NSUB; k++) {
+            nin += nlane[k];
+            if (nlane[k] > perlane) perlane = nlane[k];
+        }
+        if (nin == 0) continue;
+        ldt_hist_reserve(hist, &sub, nin, perlane);
+
+        for (int f = 0; f < ncol; f++) {
+            LdtPacked* p = cols + f;
+            long off = (long)f * nbin * nclass;
+            if (p->width == 0) {
+                unsigned int* fc = hist->counts + off;
+                for (int c = 0; c < nclass; c++)
+                    fc[p->base * nclass + c] += blkcnt[c];
+                continue;
+            }
+            ldt_ds_unpack(p, ds->words, n, codes);
+            if (sub.width == 0) {
+                unsigned int* fc = hist->counts + off;
+                for (int i = 0; i < n; i++)
+                    fc[codes[i] * nclass + cls[i]] += in[i];
+            } else if (sub.width == 1) {
+                ldt_ds_accum8((unsigned char*)sub.buf + off, len, codes, cls,
+                              in, n, nclass);
+            } else {
+                ldt_ds_accum16((unsigned short*)sub.buf + off, len, codes, cls,
+                               in, n, nclass);
+            }
+        }
+    }
+    ldt_hist_flush(hist, &sub);
+}
+
+void dtree_dataset_free(Dataset* ds) {
+    free(ds->edges), free(ds->blocks), free(ds->words);
+    free(ds);
+}
+
+//
+// Isolation forest implementations
+
+// average path length of an unsuccessful BST search among n points, used to
+// normalize path lengths and to account for the unexpanded part of a leaf
+static inline float ldt_avgpath(int n) {
+    if (n <= 1) return 0;
+    if (n == 2) return 1;
+    return 2 * (logf(n - 1) + 0.5772156649f) - 2 * (n - 1) / (float)n;
+}
+
+static inline float ldt_randunif() { return rand() / (RAND_MAX + 1.0f); }
+
+// Grows an isolation tree on the rows of data, partitioning them in place.
+// Splits use a random feature and a random threshold between its min and
+// max, so no impurity is ever computed.
+Tree* ldt_grow_isolation(float* data, int ncol, int nrow, int depth,
+                         int maxdepth) {
+    Tree* n = (Tree*)malloc(sizeof(*n));
+    n->lnode = NULL;
+    n->rnode = NULL;
+    n->gain = 0;
+    n->nsample = nrow;
+    n->nclass = 0;
+    n->counts = NULL;
+
+    int featidx = -1;
+    float min = 0, max = 0;
+    if (nrow > 1 && depth < maxdepth) {
+        // try the features in a random rotation until a non-constant one
+        int start = rand() % ncol;
+        for (int k = 0; k < ncol && featidx < 0; k++) {
+            int f = (start + k) % ncol;
+            min = max = data[f];
+            for (int i = 1; i < nrow; i++) {
+                float x = data[f + ncol * i];
+                min = x < min ? x : min;
+                max = x > max ? x : max;
+            }
+            if (min < max) featidx = f;
+        }
+    }
+
+    if (featidx < 0) {
+        n->isleaf = 1;
+        n->value = ldt_avgpath(nrow);
+        return n;
+    }
+
+    float thresh = min + ldt_randunif() * (max - min);
+    if (thresh >= max) thresh = min;
+
+    // partition rows so that those going left come first
+    int lnrow = 0;
+    float tmp[ncol];
+    for (int i = 0; i < nrow; i++) {
+        if (data[featidx + ncol * i] <= thresh) {
+            if (i != lnrow) {
+                memcpy(tmp, data + ncol * i, ncol * sizeof(*data));
+                memcpy(data + ncol * i, data + ncol * lnrow,
+                       ncol * sizeof(*data));
+                memcpy(data + ncol * lnrow, tmp, ncol * sizeof(*data));
+            }
+            lnrow++;
+        }
+    }
+
+    n->isleaf = 0;
+    n->featidx = featidx;
+    n->thresh = thresh;
+    n->lnode = ldt_grow_isolation(data, ncol, lnrow, depth + 1, maxdepth);
+    n->rnode = ldt_grow_isolation(data + ncol * lnrow, ncol, nrow - lnrow,
+                                  depth + 1, maxdepth);
+    return n;
+}
+
+Forest* dtree_iforest_grow(float* data, int ncol, int nrow, int ntree,
+                           int nsub) {
+    if (nsub > nrow) nsub = nrow;
+    int maxdepth = (int)ceilf(log2f(nsub > 1 ? nsub : 2));
+
+    Forest* forest = (Forest*)malloc(sizeof(*forest));
+    forest->ntree = ntree;
+    forest->nclass = 0;
+    forest->nsub = nsub;
+    forest->oob_error = NAN;
+    forest->oobnrow = 0;
+    forest->oobvotes = NULL;
+    forest->bins = NULL;
+    forest->trees = (Tree**)malloc(ntree * sizeof(*forest->trees));
+
+    float* sub = (float*)malloc(ncol * nsub * sizeof(*sub));
+    int* perm = (int*)malloc(nrow * sizeof(*perm));
+    for (int i = 0; i < nrow; i++) perm[i] = i;
+
+    for (int t = 0; t < ntree; t++) {
+        // subsample without replacement (partial Fisher-Yates shuffle)
+        for (int i = 0; i < nsub; i++) {
+            int j = i + rand() % (nrow - i);
+            int r = perm[j];
+            perm[j] = perm[i];
+            perm[i] = r;
+            memcpy(sub + i * ncol, data + r * ncol, ncol * sizeof(*data));
+        }
+        forest->trees[t] = ldt_grow_isolation(sub, ncol, nsub, 0, maxdepth);
+    }
+
+    free(sub), free(perm);
+    return forest;
+}
+
+void dtree_iforest_score(Forest* forest, float* data, int ncol, int nrow,
+                         float* out) {
+    for (int i = 0; i < nrow; i++) out[i] = 0;
+
+    // tree-major order keeps one tree hot in cache for the whole batch
+    for (int t = 0; t < forest->ntree; t++) {
+        for (int i = 0; i < nrow; i++) {
+            float* row = data + i * ncol;
+            Tree* n = forest->trees[t];
+            int depth = 0;
+            while (!n->isleaf) {
+                n = row[n->featidx] <= n->thresh ? n->lnode : n->rnode;
+                depth++;
+            }
+            out[i] += depth + n->value;
+        }
+    }
+
+    // s(x) = 2^(-E[h(x)] / c(nsub)); close to 1 for anomalies
+    float norm = forest->ntree * ldt_avgpath(forest->nsub);
+    for (int i = 0; i < nrow; i++)
+        out[i] = norm > 0 ? powf(2, -out[i] / norm) : 0.5f;
+}
+
+//
+// TreeSHAP implementations (Lundberg et al., polynomial-time algorithm)
+
+typedef struct ShapPath {
+    int featidx;
+    float zero;  // fraction of "feature missing" paths flowing through
+    float one;  // fraction of "feature present" paths flowing through
+    float weight;
+} ShapPath;
+
+// The attributed output is node->value, the predicted class index, which
+// only has a meaning as a number for binary trees.
+
+// expected tree output over the training rows, i.e. the SHAP base value
+float ldt_meanvalue(Tree* tree) {
+    if (tree->isleaf) return tree->value;
+    return (ldt_meanvalue(tree->lnode) * tree->lnode->nsample +
+            ldt_meanvalue(tree->rnode) * tree->rnode->nsample) /
+           tree->nsample;
+}
+
+static void ldt_shap_extend(ShapPath* path, int depth, float zero, float one,
+                            int featidx) {
+    path[depth].featidx = featidx;
+    path[depth].zero = zero;
+    path[depth].one = one;
+    path[depth].weight = depth == 0 ? 1 : 0;
+    for (int i = depth - 1; i >= 0; i--) {
+        path[i + 1].weight += one * path[i].weight * (i + 1) / (depth + 1.0f);
+        path[i].weight = zero * path[i].weight * (depth - i) / (depth + 1.0f);
+    }
+}
+
+static void ldt_shap_unwind(ShapPath* path, int depth, int pathidx) {
+    float one = path[pathidx].one;
+    float zero = path[pathidx].zero;
+    float next = path[depth].weight;
+    for (int i = depth - 1; i >= 0; i--) {
+        if (one != 0) {
+            float tmp = path[i].weight;
+            path[i].weight = next * (depth + 1) / ((i + 1) * one);
+            next = tmp - path[i].weight * zero * (depth - i) / (depth + 1.0f);
+        } else {
+            path[i].weight = path[i].weight * (depth + 1) / (zero * (depth - i));
+        }
+    }
+    for (int i = pathidx; i < depth; i++) {
+        path[i].featidx = path[i + 1].featidx;
+        path[i].zero = path[i + 1].zero;
+        path[i].one = path[i + 1].one;
+    }
+}
+
+static float ldt_shap_unwoundsum(ShapPath* path, int depth, int pathidx) {
+    float one = path[pathidx].one;
+    float zero = path[pathidx].zero;
+    float next = path[depth].weight;
+    float total = 0;
+    for (int i = depth - 1; i >= 0; i--) {
+        if (one != 0) {
+            float tmp = next * (depth + 1) / ((i + 1) * one);
+            total += tmp;
+            next = path[i].weight - tmp * zero * (depth - i) / (depth + 1.0f);
+        } else if (zero != 0) {
+            total += path[i].weight / zero / ((depth - i) / (depth + 1.0f));
+        }
+    }
+    return total;
+}
+
+// `parent` holds the unique path of the parent node; the path of this node
+// is built right after it, so the scratch needs (maxdepth+2)(maxdepth+3)/2
+// entries for the whole recursion.
+static void ldt_shap_recurse(Tree* node, float* data, float* phi,
+                             ShapPath* parent, int depth, float zero,
+                             float one, int featidx) {
+    ShapPath* path = parent + depth + 1;
+    memcpy(path, parent, (depth + 1) * sizeof(*path));
+    ldt_shap_extend(path, depth, zero, one, featidx);
+
+    if (node->isleaf) {
+        for (int i = 1; i <= depth; i++) {
+            float w = ldt_shap_unwoundsum(path, depth, i);
+            phi[path[i].featidx] +=
+                w * (path[i].one - path[i].zero) * node->value;
+        }
+        return;
+    }
+
+    int goleft = data[node->featidx] <= node->thresh;
+    Tree* hot = goleft ? node->lnode : node->rnode;
+    Tree* cold = goleft ? node->rnode : node->lnode;
+    float hotzero = hot->nsample / (float)node->nsample;
+    float coldzero = cold->nsample / (float)node->nsample;
+
+    // undo an earlier split on the same feature so it is accounted once
+    float inzero = 1, inone = 1;
+    int pathidx = 0;
+    while (pathidx <= depth && path[pathidx].featidx != node->featidx)
+        pathidx++;
+    if (pathidx <= depth) {
+        inzero = path[pathidx].zero;
+        inone = path[pathidx].one;
+        ldt_shap_unwind(path, depth, pathidx);
+        depth--;
+    }
+
+    ldt_shap_recurse(hot, data, phi, path, depth + 1, hotzero * inzero, inone,
+                     node->featidx);
+    ldt_shap_recurse(cold, data, phi, path, depth + 1, coldzero * inzero, 0,
+                     node->featidx);
+}
+
+static void ldt_shap_row(Tree* tree, float* data, int ncol, float* phi,
+                         int maxdepth, float base) {
+    int maxd = maxdepth + 2;
+    ShapPath path[(maxd * (maxd + 1)) / 2];
+    for (int f = 0; f < ncol; f++) phi[f] = 0;
+    phi[ncol] = base;
+    ldt_shap_recurse(tree, data, phi, path, 0, 1, 1, -1);
+}
+
+void dtree_shap_single(Tree* tree, float* data, int ncol, float* phi) {
+    ldt_shap_row(tree, data, ncol, phi, ldt_depth(tree), ldt_meanvalue(tree));
+}
+
+void dtree_shap(Tree* tree, float* data, int ncol, int nrow, float* out) {
+    int maxdepth = ldt_depth(tree);
+    float base = ldt_meanvalue(tree);
+
+    // rows are independent, so they are spread over threads when built
+    // with OpenMP
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < nrow; i++)
+        ldt_shap_row(tree, data + (long)i * ncol, ncol,
+                     out + (long)i * (ncol + 1), maxdepth, base);
+}
+
+//
+// Partial dependence implementations ("recursion" method)
+
+// Splits on a grid feature follow the grid value; splits on any other
+// feature visit both children, weighted by the share of training rows that
+// went each way. This equals averaging the prediction over the training set
+// with the grid features replaced, without touching the data. Averaging
+// class indices only makes sense for binary trees.
+static float ldt_pdp_recurse(Tree* node, int* feats, int nfeat, float* point,
+                             float weight) {
+    if (node->isleaf) return weight * node->value;
+
+    for (int k = 0; k < nfeat; k++) {
+        if (feats[k] != node->featidx) continue;
+        Tree* next = point[k] <= node->thresh ? node->lnode : node->rnode;
+        return ldt_pdp_recurse(next, feats, nfeat, point, weight);
+    }
+
+    float lw = node->lnode->nsample / (float)node->nsample;
+    float rw = node->rnode->nsample / (float)node->nsample;
+    return ldt_pdp_recurse(node->lnode, feats, nfeat, point, weight * lw) +
+           ldt_pdp_recurse(node->rnode, feats, nfeat, point, weight * rw);
+}
+
+void dtree_partial_dependence(Tree* tree, int* feats, int nfeat, float* grid,
+                              int ngrid, float* out) {
+    for (int g = 0; g < ngrid; g++)
+        out[g] = ldt_pdp_recurse(tree, feats, nfeat, grid + g * nfeat, 1);
+}
+
+//
+// Flat (position-independent) model implementations
+
+#define LDT_FLAT_MAGIC 0x4c445446u  // "LDTF"
+
+// The flat model is a single contiguous block: the FlatModel header, then
+// the root index of every tree, then all nodes in pre-order. Children are
+// referenced by their index in the node array rather than by pointer, so
+// the block can be copied, written to disk or mapped at any address.
+struct FlatModel {
+    unsigned int magic;
+    int ntree;
+    int nclass;
+    int nnode;
+};
+
+typedef struct FlatNode {
+    int featidx;  // -1 for leaves
+    float thresh;  // holds the predicted value for leaves
+    int lnode;
+    int rnode;
+} FlatNode;
+
+static inline int* ldt_flat_roots(FlatModel* m) { return (int*)(m + 1); }
+
+static inline FlatNode* ldt_flat_nodes(FlatModel* m) {
+    return (FlatNode*)(ldt_flat_roots(m) + m->ntree);
+}
+
+int ldt_countnodes(Tree* tree) {
+    if (tree->isleaf) return 1;
+    return 1 + ldt_countnodes(tree->lnode) + ldt_countnodes(tree->rnode);
+}
+
+int ldt_flatten(Tree* tree, FlatNode* nodes, int* next) {
+    int idx = (*next)++;
+    FlatNode* n = nodes + idx;
+    if (tree->isleaf) {
+        n->featidx = -1;
+        n->thresh = tree->value;
+        n->lnode = n->rnode = -1;
+    } else {
+        n->featidx = tree->featidx;
+        n->thresh = tree->thresh;
+        n->lnode = ldt_flatten(tree->lnode, nodes, next);
+        n->rnode = ldt_flatten(tree->rnode, nodes, next);
+    }
+    return idx;
+}
+
+long dtree_flat_size(Tree** trees, int ntree) {
+    long nnode = 0;
+    for (int t = 0; t < ntree; t++) nnode += ldt_countnodes(trees[t]);
+    return sizeof(FlatModel) + ntree * sizeof(int) + nnode * sizeof(FlatNode);
+}
+
+FlatModel* dtree_flatten(Tree** trees, int ntree, int nclass, void* buf) {
+    FlatModel* m = (FlatModel*)buf;
+    m->magic = 0;
+    m->ntree = ntree;
+    m->nclass = nclass;
+
+    int next = 0;
+    int* roots = ldt_flat_roots(m);
+    FlatNode* nodes = ldt_flat_nodes(m);
+    for (int t = 0; t < ntree; t++) roots[t] = ldt_flatten(trees[t], nodes, &next);
+    m->nnode = next;
+
+    // the magic goes last: a reader that sees it sees a complete model
+#ifdef __GNUC__
+    __sync_synchronize();
+#endif
+    *(volatile unsigned int*)&m->magic = LDT_FLAT_MAGIC;
+    return m;
+}
+
+static inline float ldt_flat_tree_predict(FlatNode* nodes, int idx,
+                                          float* data) {
+    while (nodes[idx].featidx >= 0) {
+        FlatNode* n = nodes + idx;
+        idx = data[n->featidx] <= n->thresh ? n->lnode : n->rnode;
+    }
+    return nodes[idx].thresh;
+}
+
+// A flattened isolation forest (nclass == 0) predicts NAN, as in
+// dtree_forest_predict_single.
+float dtree_flat_predict_single(FlatModel* model, float* data) {
+    if (model->nclass <= 0) return NAN;
+    int* roots = ldt_flat_roots(model);
+    FlatNode* nodes = ldt_flat_nodes(model);
+    if (model->ntree == 1) return ldt_flat_tree_predict(nodes, roots[0], data);
+
+    // majority vote of the trees, as in dtree_forest_predict_single
+    float votes[model->nclass];
+    for (int c = 0; c < model->nclass; c++) votes[c] = 0;
+    for (int t = 0; t < model->ntree; t++)
+        votes[(int)ldt_flat_tree_predict(nodes, roots[t], data)] += 1;
+
+    int best = 0;
+    for (int c = 1; c < model->nclass; c++)
+        if (votes[c] > votes[best]) best = c;
+    return (float)best;
+}
+
+void dtree_flat_predict(FlatModel* model, float* data, int ncol, int nrow,
+                        float* out) {
+    for (int i = 0; i < nrow; i++)
+        out[i] = dtree_flat_predict_single(model, data + i * ncol);
+}
+
+#ifdef LIBDTREE_SHM_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Creates (or replaces) the POSIX shared-memory object `name` holding the
+// flat model and returns a read-only mapping of it. A previous object of
+// that name is unlinked, not overwritten: workers attached to it keep their
+// copy until they detach, and new attaches get the new model.
+FlatModel* dtree_shm_publish(const char* name, Tree** trees, int ntree,
+                             int nclass) {
+    long size = dtree_flat_size(trees, ntree);
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    void* buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    FlatModel* m = dtree_flatten(trees, ntree, nclass, buf);
+    mprotect(buf, size, PROT_READ);
+    return m;
+}
+
+// Maps an existing flat model segment read-only. Every process attaching
+// the same name shares one physical copy of the model.
+FlatModel* dtree_shm_attach(const char* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FlatModel)) {
+        close(fd);
+        return NULL;
+    }
+
+    void* buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) return NULL;
+
+    FlatModel* m = (FlatModel*)buf;
+    if (m->magic != LDT_FLAT_MAGIC) {
+        munmap(buf, st.st_size);
+        return NULL;
+    }
+    return m;
+}
+
+void dtree_shm_detach(FlatModel* model) {
+    munmap(model, sizeof(FlatModel) + model->ntree * sizeof(int) +
+                      model->nnode * sizeof(FlatNode));
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Unit testing
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef LIBDTREE_TEST_
+
+#include <stdio.h>
+
+void assert_eq_int(int x, int y, char* title) {
+    if (x == y)
+        printf("\033[32m[PASS] %s\033[0m\n", title);
+    else
+        printf("\033[31m[FAIL] %s: left=%d right=%d\033[31m\n", title, x, y);
+}
+
+void assert_eq_float(float x, float y, char* title) {
+    if (x == y)
+        printf("\033[32m[PASS] %s\033[0m\n", title);
+    else
+        printf("\033[31m[FAIL] %s: left=%f right=%f\033[31m\n", title, x, y);
+}
+
+void test_list() {
+    List l = ldt_listalloc();
+    ldt_listpush(&l, 1), ldt_listpush(&l, 2), ldt_listpush(&l, 3);
+    assert_eq_int(l.len, 3, "list_len_equals_to_3");
+    assert_eq_float(l.data[1], 2, "2nd_list_elem_equals_to_2");
+    ldt_listfree(&l);
+}
+
+void test_arrunique() {
+    float arr[7] = {1, 2, 3, 3, 4, 5, 4};
+    float* bc = ldt_bincount(arr, 7);
+    assert_eq_float(bc[0], 0, "test_bincount_0");
+    assert_eq_float(bc[1], 1, "test_bincount_1");
+    assert_eq_float(bc[2], 1, "test_bincount_2");
+    assert_eq_float(bc[3], 2, "test_bincount_3");
+    assert_eq_float(bc[4], 2, "test_bincount_4");
+    assert_eq_float(bc[5], 1, "test_bincount_5");
+    free(bc);
+}
+
+void test_ispure() {
+    float arr_impure[7] = {1, 2, 3, 3, 4, 5, 4};
+    float arr_pure[7] = {1, 1, 1, 1, 1, 1, 1};
+    assert_eq_int(ispure(arr_impure, 7), 0, "test_impure");
+    assert_eq_int(ispure(arr_pure, 7), 1, "test_pure");
+}
+
+void test_classify() {
+    float case1[5] = {1, 1, 2, 2, 2};
+    Tree* res1 = classify_asleaf(case1, 5);
+    assert_eq_int(res1->isleaf, 1, "test_classification_res_is_a_leaf");
+    assert_eq_int(res1->value, 2, "test_classification_case1_is_correct");
+
+    float case2[5] = {1, 1, 1, 1, 1};
+    Tree* res2 = classify_asleaf(case2, 5);
+    assert_eq_int(res2->value, 1, "test_classification_case2_is_correct");
+
+    float case3[1] = {8};
+    Tree* res3 = classify_asleaf(case3, 1);
+    assert_eq_int(res3->value, 8, "test_classification_case3_is_correct");
+}
+
+void test_nodestats() {
+    float target[4] = {0, 2, 1, 2};
+    unsigned int cnt[3];
+    NodeStats st = ldt_nodestats(target, 4, 3, cnt);
+    assert_eq_int(cnt[2], 2, "test_nodestats_count");
+    assert_eq_int(st.npresent, 3, "test_nodestats_npresent");
+    assert_eq_float(st.entropy, 1.5f, "test_nodestats_entropy");
+
+    Tree* leaf = ldt_leaf(cnt, 3);
+    assert_eq_float(leaf->value, 2, "test_nodestats_leaf_majority");
+    assert_eq_int(leaf->nsample, 4, "test_nodestats_leaf_nsample");
+    dtree_free(leaf);
+}
+
+void test_arrdiv() {
+    float arr[2] = {4, 4};
+    ldt_arrdiv(arr, 2, 2);
+    assert_eq_int(arr[0], 2, "test_4/4=2");
+    assert_eq_int(arr[1], 2, "test_4/4=2");
+    ldt_arrdiv(arr, 2, 2);
+    assert_eq_int(arr[0], 1, "test_2/2=1");
+    assert_eq_int(arr[1], 1, "test_2/2=1");
+}
+
+void test_forest_oob() {
+    float data[20];
+    float target[20];
+    for (int i = 0; i < 20; i++) {
+        data[i] = i;
+        target[i] = i >= 10;
+    }
+    TreeParam param = {.maxdepth = 5, .min_sample_split = 1};
+    srand(42);
+    Forest* forest = dtree_forest_grow(data, target, 1, 20, 25, param);
+    assert_eq_int(forest->ntree, 25, "test_forest_ntree");
+    assert_eq_int(forest->oob_error <= 0.1f, 1, "test_forest_oob_error_low");
+
+    float x[1] = {15};
+    assert_eq_float(dtree_forest_predict_single(forest, x), 1,
+                    "test_forest_predict_single");
+    dtree_forest_free(forest);
+}
+
+void test_forest_extend() {
+    float data[20];
+    float target[20];
+    for (int i = 0; i < 20; i++) {
+        data[i] = i;
+        target[i] = i >= 10;
+    }
+    TreeParam param = {.maxdepth = 5, .min_sample_split = 1};
+    srand(42);
+    Forest* forest = dtree_forest_grow(data, target, 1, 20, 3, param);
+    Tree* first = forest->trees[0];
+    dtree_forest_extend(forest, data, target, 1, 20, 22, param, 1);
+    assert_eq_int(forest->ntree, 25, "test_forest_extend_ntree");
+    assert_eq_int(forest->trees[0] == first, 1, "test_forest_extend_keeps_trees");
+    assert_eq_int(forest->oob_error <= 0.1f, 1, "test_forest_extend_oob_error");
+
+    // other rows of the same size: the earlier votes must not be mixed in
+    for (int i = 0; i < 20; i++) target[i] = i < 10;
+    dtree_forest_extend(forest, data, target, 1, 20, 25, param, 0);
+    assert_eq_int(forest->oob_error <= 0.1f, 1, "test_forest_extend_new_rows");
+    dtree_forest_free(forest);
+}
+
+void test_iforest() {
+    float data[64];
+    for (int i = 0; i < 63; i++) data[i] = i % 8;
+    data[63] = 100;
+    srand(42);
+    Forest* forest = dtree_iforest_grow(data, 1, 64, 50, 32);
+
+    float x[2] = {4, 100};
+    float score[2];
+    dtree_iforest_score(forest, x, 1, 2, score);
+    assert_eq_int(score[1] > score[0], 1, "test_iforest_outlier_scores_higher");
+    assert_eq_int(score[1] > 0.5f, 1, "test_iforest_outlier_score_above_half");
+
+    // not a classifier
+    float pred[2];
+    dtree_forest_predict(forest, x, 1, 2, pred);
+    assert_eq_int(isnan(pred[0]), 1, "test_iforest_predict_nan");
+    dtree_forest_predict_binned(forest, x, 1, 2, pred);
+    assert_eq_int(isnan(pred[1]), 1, "test_iforest_predict_binned_nan");
+    void* buf = malloc(dtree_flat_size(forest->trees, forest->ntree));
+    FlatModel* model =
+        dtree_flatten(forest->trees, forest->ntree, forest->nclass, buf);
+    dtree_flat_predict(model, x, 1, 2, pred);
+    assert_eq_int(isnan(pred[0]) && isnan(pred[1]), 1,
+                  "test_iforest_flat_predict_nan");
+    free(buf);
+    dtree_forest_free(forest);
+}
+
+void test_flat() {
+    float data[8] = {1, 1, 0, 1, 1, 0, 0, 0};
+    float target[4] = {0, 1, 1, 0};
+    Tree* tree = dtree_grow(data, target, 2, 4);
+
+    char buf[dtree_flat_size(&tree, 1)];
+    FlatModel* model = dtree_flatten(&tree, 1, 2, buf);
+    assert_eq_int(model->nnode, ldt_countnodes(tree), "test_flat_nnode");
+
+    float out[4];
+    dtree_flat_predict(model, data, 2, 4, out);
+    for (int i = 0; i < 4; i++)
+        assert_eq_float(out[i], target[i], "test_flat_predict");
+
+#ifdef LIBDTREE_SHM_
+    // republishing leaves the model of an attached reader untouched
+    const char* name = "/libdtree_test_flat";
+    FlatModel* pub = dtree_shm_publish(name, &tree, 1, 2);
+    FlatModel* reader = dtree_shm_attach(name);
+    assert_eq_int(reader != NULL, 1, "test_shm_attach");
+    unsigned int cnt[2] = {3, 1};
+    Tree* stump = ldt_leaf(cnt, 2);
+    FlatModel* repub = dtree_shm_publish(name, &stump, 1, 2);
+    assert_eq_int(reader->nnode, model->nnode, "test_shm_republish_reader");
+    FlatModel* fresh = dtree_shm_attach(name);
+    assert_eq_int(fresh->nnode, 1, "test_shm_republish_fresh");
+    dtree_shm_detach(pub), dtree_shm_detach(reader);
+    dtree_shm_detach(repub), dtree_shm_detach(fresh);
+    shm_unlink(name);
+    dtree_free(stump);
+#endif
+    dtree_free(tree);
+}
+
+void test_shap() {
+    float data[8] = {1, 1, 0, 1, 1, 0, 0, 0};
+    float target[4] = {0, 1, 1, 0};
+    Tree* tree = dtree_grow(data, target, 2, 4);
+
+    float phi[4 * 3];
+    dtree_shap(tree, data, 2, 4, phi);
+    assert_eq_float(phi[2], 0.5f, "test_shap_base_value");
+    for (int i = 0; i < 4; i++) {
+        // local accuracy: base value plus attributions equals the prediction
+        float* p = phi + i * 3;
+        assert_eq_int(fabsf(p[0] + p[1] + p[2] - target[i]) < 1e-5f, 1,
+                      "test_shap_local_accuracy");
+    }
+    dtree_free(tree);
+}
+
+void test_partial_dependence() {
+    float data[8] = {1, 1, 0, 1, 1, 0, 0, 0};
+    float target[4] = {0, 1, 1, 0};
+    Tree* tree = dtree_grow(data, target, 2, 4);
+
+    // XOR: fixing one input leaves the output equally likely 0 or 1
+    int feat = 0;
+    float grid[2] = {0, 1};
+    float out[4];
+    dtree_partial_dependence(tree, &feat, 1, grid, 2, out);
+    assert_eq_float(out[0], 0.5f, "test_pdp_one_feature_0");
+    assert_eq_float(out[1], 0.5f, "test_pdp_one_feature_1");
+
+    // fixing both inputs reproduces the prediction
+    int feats[2] = {0, 1};
+    dtree_partial_dependence(tree, feats, 2, data, 4, out);
+    assert_eq_float(out[0], 0, "test_pdp_two_features_11");
+    assert_eq_float(out[1], 1, "test_pdp_two_features_01");
+    assert_eq_float(out[2], 1, "test_pdp_two_features_10");
+    assert_eq_float(out[3], 0, "test_pdp_two_features_00");
+    dtree_free(tree);
+}
+
+void test_decision_path() {
+    float data[8] = {1, 1, 0, 1, 1, 0, 0, 0};
+    float target[4] = {0, 1, 1, 0};
+    Tree* tree = dtree_grow(data, target, 2, 4);
+
+    unsigned long long path[4];
+    int pathlen[4];
+    dtree_decision_path(tree, data, 2, 4, path, pathlen);
+    for (int i = 0; i < 4; i++) {
+        Tree* leaf = dtree_path_node(tree, path[i], pathlen[i]);
+        assert_eq_int(leaf->isleaf, 1, "test_decision_path_ends_in_leaf");
+        assert_eq_float(leaf->value, target[i], "test_decision_path_leaf_value");
+    }
+    assert_eq_int(path[0] != path[1], 1, "test_decision_path_distinct");
+    dtree_free(tree);
+}
+
+void test_pathcache() {
+    float data[60];
+    float target[20];
+    for (int i = 0; i < 20; i++) {
+        data[i * 3] = i % 5;
+        data[i * 3 + 1] = i % 7;
+        data[i * 3 + 2] = i % 3;
+        target[i] = (i % 5 > 2) ^ (i % 3 == 1);
+    }
+    Tree* tree = dtree_grow(data, target, 3, 20);
+
+    float out[20];
+    PathCache* cache = dtree_pathcache_predict(tree, data, 3, 20, out);
+    int nwrong = 0;
+    for (int i = 0; i < 20; i++) {
+        data[i * 3 + 2] = (i + 1) % 3;
+        float pred = dtree_pathcache_update(cache, data + i * 3, i, 2);
+        nwrong += pred != dtree_predict_single(tree, data + i * 3);
+    }
+    assert_eq_int(nwrong, 0, "test_pathcache_update_matches_predict");
+    dtree_pathcache_free(cache);
+    dtree_free(tree);
+}
+
+void test_forest_binned() {
+    float data[80];
+    float target[40];
+    for (int i = 0; i < 40; i++) {
+        data[i * 2] = (i * 7) % 13;
+        data[i * 2 + 1] = (i * 5) % 11;
+        target[i] = data[i * 2] + data[i * 2 + 1] > 11;
+    }
+    TreeParam param = {.maxdepth = 4, .min_sample_split = 2};
+    srand(7);
+    Forest* forest = dtree_forest_grow(data, target, 2, 40, 15, param);
+
+    // shift the rows so that values fall between and outside thresholds
+    for (int i = 0; i < 80; i++) data[i] += 0.5f - (i % 3);
+    float binned[40], plain[40];
+    dtree_forest_predict_binned(forest, data, 2, 40, binned);
+    dtree_forest_predict(forest, data, 2, 40, plain);
+    int nwrong = 0;
+    for (int i = 0; i < 40; i++) nwrong += binned[i] != plain[i];
+    assert_eq_int(nwrong, 0, "test_forest_binned_matches_predict");
+    dtree_forest_free(forest);
+
+    // stumps on more distinct thresholds than 16-bit codes can hold: the
+    // trees with thresh >= x vote 1, so x beyond the middle predicts 0
+    int nstump = LDT_BIN_MAXTHRESH + 4466;
+    Forest* wide = (Forest*)calloc(1, sizeof(*wide));
+    wide->ntree = nstump;
+    wide->nclass = 2;
+    wide->trees = (Tree**)malloc(nstump * sizeof(*wide->trees));
+    unsigned int one[2] = {0, 1}, zero[2] = {1, 0};
+    for (int t = 0; t < nstump; t++) {
+        Tree* n = (Tree*)calloc(1, sizeof(*n));
+        n->featidx = 0;
+        n->thresh = t;
+        n->lnode = ldt_leaf(one, 2);
+        n->rnode = ldt_leaf(zero, 2);
+        wide->trees[t] = n;
+    }
+    float x[2] = {nstump - 2, 10}, xbinned[2], xplain[2];
+    dtree_forest_predict_binned(wide, x, 1, 2, xbinned);
+    dtree_forest_predict(wide, x, 1, 2, xplain);
+    assert_eq_float(xbinned[0], 0, "test_forest_binned_wide_codes");
+    assert_eq_float(xbinned[1], xplain[1], "test_forest_binned_wide_matches");
+    dtree_forest_free(wide);
+}
+
+void test_lazy() {
+    float data[60];
+    float target[20];
+    for (int i = 0; i < 20; i++) {
+        data[i * 3] = i % 5;
+        data[i * 3 + 1] = i % 7;
+        data[i * 3 + 2] = i % 3;
+        target[i] = (i % 5 > 2) ^ (i % 3 == 1);
+    }
+    TreeParam param = {.maxdepth = 5, .min_sample_split = 1};
+    Tree* full = dtree_grow_with_param(data, target, 3, 20, param);
+    LazyTree* lazy = dtree_lazy_grow(data, target, 3, 20, param);
+
+    dtree_lazy_predict_single(lazy, data);
+    assert_eq_int(lazy->nexpanded <= ldt_depth(full) + 1, 1,
+                  "test_lazy_expands_single_path");
+
+    int nwrong = 0;
+    for (int i = 0; i < 20; i++)
+        nwrong += dtree_lazy_predict_single(lazy, data + i * 3) !=
+                  dtree_predict_single(full, data + i * 3);
+    assert_eq_int(nwrong, 0, "test_lazy_matches_full_tree");
+    dtree_lazy_free(lazy);
+    dtree_free(full);
+}
+
+void test_stream_drift() {
+    float data[20];
+    float target[20];
+    for (int i = 0; i < 20; i++) {
+        data[i] = i;
+        target[i] = i > 10;
+    }
+    TreeParam param = {.maxdepth = 32, .min_sample_split = 1};
+    Tree* tree = dtree_grow_with_param(data, target, 1, 20, param);
+    StreamTree* st = dtree_stream_new(tree, 1, param, 64, 0.005f, 3);
+
+    // same concept first, then a new region where the old tree is wrong
+    float x;
+    for (int i = 0; i < 100; i++) {
+        x = i % 20;
+        dtree_stream_update(st, &x, x > 10);
+    }
+    assert_eq_int(st->nregrow, 0, "test_stream_no_drift");
+    for (int i = 0; i < 200; i++) {
+        x = 20 + i % 20;
+        dtree_stream_update(st, &x, x > 30);
+    }
+    assert_eq_int(st->nregrow > 0, 1, "test_stream_drift_regrows");
+
+    int nwrong = 0;
+    for (int i = 20; i < 40; i++) {
+        x = i;
+        nwrong += dtree_predict_single(st->tree, &x) != (x > 30);
+    }
+    assert_eq_int(nwrong, 0, "test_stream_adapts_to_drift");
+    dtree_stream_free(st);
+}
+
+void test_refit_leaves() {
+    float data[8] = {1, 1, 0, 1, 1, 0, 0, 0};
+    float target[4] = {0, 1, 1, 0};
+    Tree* tree = dtree_grow(data, target, 2, 4);
+
+    // inverted labels outweigh the decayed old counts
+    float flipped[4] = {1, 0, 0, 2};
+    dtree_refit_leaves(tree, data, flipped, 2, 4, 0.5f);
+    float out[4];
+    dtree_predict(tree, data, 2, 4, out);
+    for (int i = 0; i < 4; i++)
+        assert_eq_float(out[i], flipped[i], "test_refit_leaves_value");
+    // every leaf holds half an old row and a new one, rounded up
+    assert_eq_int(tree->nsample, 8, "test_refit_leaves_nsample");
+    dtree_free(tree);
+}
+
+void test_split_range() {
+    // the best split is on the last feature; a range without it finds
+    // another one, a range with it finds it
+    float data[12] = {0, 5, 0, 1, 2, 0, 0, 3, 1, 1, 4, 1};
+    float target[4] = {0, 0, 1, 1};
+    unsigned int cnt[2];
+    NodeStats st = ldt_nodestats(target, 4, 2, cnt);
+    SplitCand all = ldt_best_split_range(data, target, 3, 4, 0, 3, NULL, &st);
+    SplitCand head = ldt_best_split_range(data, target, 3, 4, 0, 2, NULL, &st);
+    SplitCand tail = ldt_best_split_range(data, target, 3, 4, 2, 3, NULL, &st);
+    assert_eq_int(all.featidx, 2, "test_split_range_all");
+    assert_eq_int(head.featidx != 2, 1, "test_split_range_head");
+    assert_eq_int(tail.featidx, 2, "test_split_range_tail");
+    assert_eq_float(tail.gain, all.gain, "test_split_range_same_gain");
+
+    unsigned char bitmap[1];
+    Split split = {.ldata = NULL};
+    ldt_split_bitmap(data, 3, 4, all.featidx, all.thresh, bitmap);
+    ldt_partition(data, target, 3, 4, bitmap, &split);
+    assert_eq_int(split.lnrow, 2, "test_partition_bitmap_lnrow");
+    assert_eq_float(split.rtarget[0], 1, "test_partition_bitmap_rtarget");
+    free(split.ldata), free(split.ltarget);
+    free(split.rdata), free(split.rtarget);
+}
+
+void test_best_split_gain() {
+    // the split kept is the one with the highest gain, not the last
+    // threshold that leaves rows on both sides
+    float data[4] = {0, 1, 2, 3};
+    float target[4] = {0, 0, 1, 1};
+    unsigned int cnt[2];
+    NodeStats st = ldt_nodestats(target, 4, 2, cnt);
+    Split split = best_split(data, target, 1, 4, NULL, &st);
+    assert_eq_float(split.thresh, 1, "test_best_split_gain_thresh");
+    assert_eq_float(split.gain, 1, "test_best_split_gain");
+    free(split.ldata), free(split.ltarget);
+    free(split.rdata), free(split.rtarget);
+
+    Tree* tree = dtree_grow(data, target, 1, 4);
+    assert_eq_float(tree->thresh, 1, "test_best_split_gain_grow");
+    assert_eq_int(tree->lnode->isleaf && tree->rnode->isleaf, 1,
+                  "test_best_split_gain_one_split");
+    dtree_free(tree);
+}
+
+void test_coldata() {
+    // the column-major search agrees with the row-major one, and splitting
+    // a node only reorders its indices, stably on both sides
+    float data[12] = {0, 5, 0, 1, 2, 0, 0, 3, 1, 1, 4, 1};
+    float target[4] = {0, 0, 1, 1};
+    ColData cd = ldt_coldata(data, target, 3, 4);
+    assert_eq_float(cd.cols[4 + 1], 2, "test_coldata_transpose");
+
+    int idx[4] = {0, 1, 2, 3};
+    unsigned int cnt[2];
+    NodeStats st = ldt_nodestats_idx(target, idx, 4, 2, cnt);
+    SplitCand rows = ldt_best_split_range(data, target, 3, 4, 0, 3, NULL, &st);
+    SplitCand cols = ldt_best_split_cols(&cd, idx, 4, 0, 3, NULL, &st);
+    assert_eq_int(cols.featidx, rows.featidx, "test_coldata_featidx");
+    assert_eq_float(cols.thresh, rows.thresh, "test_coldata_thresh");
+
+    unsigned char bitmap[1] = {0x5};  // rows 0 and 2 go left
+    int lnrow = ldt_partition_idx(idx, 4, bitmap, cd.scratch);
+    assert_eq_int(lnrow, 2, "test_coldata_partition_lnrow");
+    assert_eq_int(idx[1] * 10 + idx[3], 23, "test_coldata_partition_order");
+    ldt_coldata_free(&cd);
+    // the buffers of a node larger than the default 8 MB stack
+    int nrow = 1 << 21;
+    float* big = (float*)malloc(nrow * sizeof(float));
+    float* bigtarget = (float*)malloc(nrow * sizeof(float));
+    for (int i = 0; i < nrow; i++) {
+        big[i] = i % 100;
+        bigtarget[i] = big[i] >= 50;
+    }
+    TreeParam param = {.maxdepth = 1, .min_sample_split = 2};
+    Tree* tree = dtree_grow_with_param(big, bigtarget, 1, nrow, param);
+    assert_eq_float(tree->thresh, 49, "test_coldata_large_node");
+    dtree_free(tree);
+    free(big), free(bigtarget);
+}
+
+typedef struct {
+    float* data;
+    float* target;
+    int nrow;
+    float* edges;
+} HistShards;
+
+// two shards holding the first and second half of the rows
+void hist_shards_callback(void* ctx, NodeCond* conds, int ncond, Hist* out) {
+    HistShards* s = (HistShards*)ctx;
+    int half = s->nrow / 2;
+    Hist* shard = dtree_hist_alloc(out->ncol, out->nbin, out->nclass);
+    dtree_hist_build(shard, s->data, s->target, half, s->edges, conds, ncond);
+    dtree_hist_merge(out, shard);
+    memset(shard->counts, 0, dtree_hist_bytes(shard) - sizeof(*shard));
+    dtree_hist_build(shard, s->data + half * out->ncol, s->target + half,
+                     s->nrow - half, s->edges, conds, ncond);
+    dtree_hist_merge(out, shard);
+    dtree_hist_free(shard);
+}
+
+void test_hist() {
+    float data[16] = {1, 1, 0, 1, 1, 0, 0, 0, 1, 1, 0, 1, 1, 0, 0, 0};
+    float target[8] = {0, 1, 1, 0, 0, 1, 1, 0};
+    float edges[2] = {0.5f, 0.5f};
+
+    Hist* full = dtree_hist_alloc(2, 2, 2);
+    dtree_hist_build(full, data, target, 8, edges, NULL, 0);
+    assert_eq_int(full->counts[1 * 2 + 0], 2, "test_hist_build_count");
+
+    HistShards shards = {data, target, 8, edges};
+    Hist* merged = dtree_hist_alloc(2, 2, 2);
+    hist_shards_callback(&shards, NULL, 0, merged);
+    assert_eq_int(memcmp(full, merged, dtree_hist_bytes(full)), 0,
+                  "test_hist_merge_equals_full");
+    dtree_hist_subtract(merged, full);
+    assert_eq_int(merged->counts[2], 0, "test_hist_subtract");
+    dtree_hist_free(full), dtree_hist_free(merged);
+
+    TreeParam param = {.maxdepth = 5, .min_sample_split = 1};
+    Tree* tree =
+        dtree_grow_from_hist(hist_shards_callback, &shards, edges, 2, 2, 2, param);
+    float out[8];
+    dtree_predict(tree, data, 2, 8, out);
+    int nwrong = 0;
+    for (int i = 0; i < 8; i++) nwrong += out[i] != target[i];
+    assert_eq_int(nwrong, 0, "test_grow_from_hist_xor");
+    dtree_free(tree);
+}
+
+void test_dataset() {
+    // three blocks of rows: a constant column, a small-range column and a
+    // sorted one, which is constant within most blocks
+    int nrow = 2500, ncol = 3, nbin = 8;
+    float* data = (float*)malloc(nrow * ncol * sizeof(float));
+    float* target = (float*)malloc(nrow * sizeof(float));
+    srand(5);
+    for (int i = 0; i < nrow; i++) {
+        data[i * ncol] = 3;
+        data[i * ncol + 1] = rand() % 4;
+        data[i * ncol + 2] = i / 400;
+        target[i] = (data[i * ncol + 1] > 1) + (i % 7 == 0);
+    }
+    float edges[21];
+    for (int f = 0; f < ncol; f++)
+        for (int b = 0; b < nbin - 1; b++) edges[f * (nbin - 1) + b] = b + 0.5f;
+
+    Dataset* ds = dtree_dataset_new(data, target, ncol, nrow, edges, nbin);
+    assert_eq_int(dtree_dataset_bytes(ds) * 8 < (long)nrow * ncol * 4, 1,
+                  "test_dataset_compressed");
+
+    NodeCond conds[2] = {{2, 3.5f, 1}, {1, 0.5f, 0}};
+    Hist* raw = dtree_hist_alloc(ncol, nbin, 3);
+    Hist* packed = dtree_hist_alloc(ncol, nbin, 3);
+    for (int ncond = 0; ncond <= 2; ncond++) {
+        memset(raw->counts, 0, dtree_hist_bytes(raw) - sizeof(*raw));
+        memset(packed->counts, 0, dtree_hist_bytes(packed) - sizeof(*packed));
+        dtree_hist_build(raw, data, target, nrow, edges, conds, ncond);
+        dtree_dataset_hist_build(packed, ds, conds, ncond);
+        assert_eq_int(memcmp(raw, packed, dtree_hist_bytes(raw)), 0,
+                      "test_dataset_hist_build");
+    }
+    dtree_hist_free(raw), dtree_hist_free(packed);
+    dtree_dataset_free(ds);
+    free(data), free(target);
+}
+
+void test_hist_spill() {
+    // a copy that fills up at 8 bits is promoted to 16 bits
+    Hist* hist = dtree_hist_alloc(1, 2, 1);
+    LdtSubHist sub = {NULL, 0, 0, 0};
+    ldt_hist_reserve(hist, &sub, 64, 16);
+    assert_eq_int(sub.width, 1, "test_hist_spill_starts_narrow");
+    ldt_hist_reserve(hist, &sub, 1000, 250);
+    assert_eq_int(sub.width, 2, "test_hist_spill_promotes");
+    ldt_hist_flush(hist, &sub);
+    dtree_hist_free(hist);
+
+    // more rows in one bin than a 16-bit copy can hold, and a node that is
+    // sparse in the first blocks and dense later, whose 8-bit copies are
+    // promoted
+    int nrow = LDT_HIST_NSUB * 65535 + 1000, ncol = 2;
+    float* data = (float*)malloc(nrow * ncol * sizeof(float));
+    float* target = (float*)calloc(nrow, sizeof(float));
+    int nzero[2] = {0, 0};
+    for (int i = 0; i < nrow; i++) {
+        data[i * ncol] = i % 1000 == 0;  // no constant block
+        data[i * ncol + 1] = i < 2048 ? i % 64 == 0 : i % 2 == 0;
+        nzero[0] += data[i * ncol] == 0;
+        nzero[1] += data[i * ncol] == 0 && data[i * ncol + 1] == 1;
+    }
+    float edges[2] = {0.5f, 0.5f};
+    NodeCond cond = {1, 0.5f, 0};
+
+    Dataset* ds = dtree_dataset_new(data, target, ncol, nrow, edges, 2);
+    Hist* raw = dtree_hist_alloc(ncol, 2, 1);
+    Hist* packed = dtree_hist_alloc(ncol, 2, 1);
+    for (int ncond = 0; ncond <= 1; ncond++) {
+        memset(raw->counts, 0, dtree_hist_bytes(raw) - sizeof(*raw));
+        memset(packed->counts, 0, dtree_hist_bytes(packed) - sizeof(*packed));
+        dtree_hist_build(raw, data, target, nrow, edges, &cond, ncond);
+        dtree_dataset_hist_build(packed, ds, &cond, ncond);
+        assert_eq_int(raw->counts[0], nzero[ncond], "test_hist_spill_raw");
+        assert_eq_int(memcmp(raw, packed, dtree_hist_bytes(raw)), 0,
+                      "test_hist_spill_dataset");
+    }
+    dtree_hist_free(raw), dtree_hist_free(packed);
+    dtree_dataset_free(ds);
+    free(data), free(target);
+}
+
+void test_predict_half() {
+    assert_eq_float(ldt_f16tofloat(0x3c00), 1, "test_f16_one");
+    assert_eq_float(ldt_f16tofloat(0xc000), -2, "test_f16_minus_two");
+    assert_eq_float(ldt_f16tofloat(0x0001), ldexpf(1, -24), "test_f16_subnormal");
+    assert_eq_float(ldt_bf16tofloat(0x3f80), 1, "test_bf16_one");
+
+    float data[8] = {1, 1, 0, 1, 1, 0, 0, 0};
+    float target[4] = {0, 1, 1, 0};
+    Tree* tree = dtree_grow(data, target, 2, 4);
+
+    unsigned short f16[8], bf16[8];
+    for (int i = 0; i < 8; i++) {
+        f16[i] = data[i] ? 0x3c00 : 0;
+        bf16[i] = data[i] ? 0x3f80 : 0;
+    }
+    float out16[4], outbf16[4];
+    dtree_predict_f16(tree, f16, 2, 4, out16);
+    dtree_predict_bf16(tree, bf16, 2, 4, outbf16);
+    for (int i = 0; i < 4; i++) {
+        assert_eq_float(out16[i], target[i], "test_predict_f16");
+        assert_eq_float(outbf16[i], target[i], "test_predict_bf16");
+    }
+    dtree_free(tree);
+}
+
+typedef struct {
+    float* row;
+    int nfetch;
+} FetchCtx;
+
+float fetch_counting(void* ctx, int featidx) {
+    FetchCtx* c = (FetchCtx*)ctx;
+    c->nfetch++;
+    return c->row[featidx];
+}
+
+void test_cost_aware() {
+    // feature 0 and feature 1 both separate the classes perfectly, but
+    // feature 0 is expensive
+    float data[16] = {0, 0, 1, 0, 2, 1, 3, 1, 4, 2, 5, 2, 6, 3, 7, 3};
+    float target[8] = {0, 0, 0, 0, 1, 1, 1, 1};
+    float cost[2] = {10, 0.1f};
+    TreeParam param = {.maxdepth = 5, .min_sample_split = 1,
+                       .featcost = cost, .costweight = 0.05f};
+    Tree* tree = dtree_grow_with_param(data, target, 2, 8, param);
+    assert_eq_int(tree->featidx, 1, "test_cost_aware_prefers_cheap_feature");
+
+    // a split that does not pay for its feature is not made
+    cost[1] = 2;
+    param.costweight = 1;
+    Tree* stump = dtree_grow_with_param(data, target, 2, 8, param);
+    assert_eq_int(stump->isleaf, 1, "test_cost_aware_too_expensive");
+
+    FetchCtx ctx = {data + 12, 0};
+    float pred = dtree_predict_fetch(tree, 2, fetch_counting, &ctx);
+    assert_eq_float(pred, 1, "test_predict_fetch_value");
+    assert_eq_int(ctx.nfetch, 1, "test_predict_fetch_only_needed");
+    dtree_free(tree), dtree_free(stump);
+}
+
+int same_tree(Tree* a, Tree* b) {
+    if (a->isleaf != b->isleaf) return 0;
+    if (a->isleaf) return a->value == b->value && a->nsample == b->nsample;
+    return a->featidx == b->featidx && a->thresh == b->thresh &&
+           same_tree(a->lnode, b->lnode) && same_tree(a->rnode, b->rnode);
+}
+
+void test_expected_depth_budget() {
+    float data[32];
+    float target[32];
+    for (int i = 0; i < 32; i++) {
+        data[i] = i;
+        target[i] = (i / 4) % 2;
+    }
+    TreeParam param = {.maxdepth = 16, .min_sample_split = 1};
+    Tree* full = dtree_grow_with_param(data, target, 1, 32, param);
+
+    param.max_expected_depth = 2.5f;
+    Tree* budget = dtree_grow_with_param(data, target, 1, 32, param);
+    assert_eq_int(dtree_expected_depth(budget) <= 2.5f, 1,
+                  "test_budget_expected_depth_within_budget");
+    assert_eq_int(dtree_expected_depth(full) > 2.5f, 1,
+                  "test_budget_full_tree_exceeds_budget");
+
+    // a budget that is never reached grows a tree as accurate as usual
+    param.max_expected_depth = 100;
+    Tree* loose = dtree_grow_with_param(data, target, 1, 32, param);
+    float out[32];
+    dtree_predict(loose, data, 1, 32, out);
+    int nwrong = 0;
+    for (int i = 0; i < 32; i++) nwrong += out[i] != target[i];
+    assert_eq_int(nwrong, 0, "test_budget_loose_fits_data");
+    dtree_free(full), dtree_free(budget), dtree_free(loose);
+
+    // feature costs apply to the leaves of the frontier as on a path
+    int ncol = 7, nrow = 300;
+    float cdata[7 * 300], ctarget[300];
+    srand(1);
+    for (int i = 0; i < nrow; i++) {
+        float* x = cdata + i * ncol;
+        for (int f = 0; f < ncol; f++) x[f] = rand() % 10;
+        ctarget[i] = ((x[0] + x[5] > 9) ^ (x[2] > 5)) + (x[6] > 7);
+    }
+    float cost[7] = {1, 0.2f, 0.5f, 2, 0, 0.1f, 0.3f};
+    TreeParam cparam = {.maxdepth = 8, .min_sample_split = 2,
+                        .featcost = cost, .costweight = 0.2f};
+    Tree* path = dtree_grow_with_param(cdata, ctarget, ncol, nrow, cparam);
+    cparam.max_expected_depth = 100;
+    Tree* front = dtree_grow_with_param(cdata, ctarget, ncol, nrow, cparam);
+    assert_eq_int(same_tree(path, front), 1, "test_budget_feature_costs");
+    dtree_free(path), dtree_free(front);
+}
+
+#ifdef LIBDTREE_MULTIPROC_
+void test_feature_parallel() {
+    int ncol = 7, nrow = 300;
+    float data[7 * 300], target[300];
+    srand(1);
+    for (int i = 0; i < nrow; i++) {
+        float* x = data + i * ncol;
+        for (int f = 0; f < ncol; f++) x[f] = rand() % 10;
+        target[i] = ((x[0] + x[5] > 9) ^ (x[2] > 5)) + (x[6] > 7);
+    }
+    TreeParam param = {.maxdepth = 8, .min_sample_split = 2};
+    Tree* serial = dtree_grow_with_param(data, target, ncol, nrow, param);
+    for (int w = 1; w <= 4; w++) {
+        Tree* par = dtree_grow_feature_parallel(data, target, ncol, nrow, param, w);
+        assert_eq_int(same_tree(serial, par), 1, "test_feature_parallel_same");
+        dtree_free(par);
+    }
+    Tree* none =
+        dtree_grow_feature_parallel(data, target, ncol, nrow, param, 0);
+    assert_eq_int(same_tree(serial, none), 1,
+                  "test_feature_parallel_no_worker");
+    dtree_free(serial), dtree_free(none);
+
+    // parameters the workers cannot follow still give the serial tree
+    float cost[7] = {1, 0.2f, 0.5f, 2, 0, 0.1f, 0.3f};
+    param.featcost = cost;
+    param.costweight = 0.2f;
+    serial = dtree_grow_with_param(data, target, ncol, nrow, param);
+    Tree* par = dtree_grow_feature_parallel(data, target, ncol, nrow, param, 3);
+    assert_eq_int(same_tree(serial, par), 1, "test_feature_parallel_featcost");
+    dtree_free(serial), dtree_free(par);
+
+    param.featcost = NULL;
+    param.max_expected_depth = 1.5f;
+    serial = dtree_grow_with_param(data, target, ncol, nrow, param);
+    par = dtree_grow_feature_parallel(data, target, ncol, nrow, param, 3);
+    assert_eq_int(same_tree(serial, par), 1, "test_feature_parallel_budget");
+    dtree_free(serial), dtree_free(par);
+}
+#endif
+
+void run_tests() {
+    test_list();
+    test_arrunique();
+    test_ispure();
+    test_classify();
+    test_arrdiv();
+    test_nodestats();
+    test_split_range();
+    test_best_split_gain();
+    test_coldata();
+    test_hist();
+    test_dataset();
+    test_hist_spill();
+    test_forest_oob();
+    test_forest_extend();
+    test_iforest();
+    test_flat();
+    test_shap();
+    test_partial_dependence();
+    test_decision_path();
+    test_pathcache();
+    test_forest_binned();
+    test_lazy();
+    test_stream_drift();
+    test_refit_leaves();
+    test_predict_half();
+    test_cost_aware();
+    test_expected_depth_budget();
+#ifdef LIBDTREE_MULTIPROC_
+    test_feature_parallel();
+#endif
 }
 
 #endif